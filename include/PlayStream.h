@@ -15,15 +15,98 @@
 #include <netinet/tcp.h>
 
 #include <pro/dhcp.h>
+#include "streamhdr.h"
 #include <time.h>
 
 
 #ifndef __PlayStream_H
 #define __PlayStream_H
 
-void PlayMp3Stream(FILE *stream, u_long metaint);
-int ProcessMetaData(FILE *stream);
-FILE *ConnectStation(TCPSOCKET *sock, u_long ip, u_short port, u_long *metaint);
+/*
+ * Jitter buffer states.
+ */
+#define JB_PREROLL      0   /* Initial fill, decoder not started yet. */
+#define JB_PLAYING      1   /* Decoder is running. */
+#define JB_REBUFFER     2   /* Decoder ran out of data, refilling. */
+
+/*!
+ * \brief Jitter buffer controller.
+ *
+ * Watermarks are configured in milliseconds of audio and converted
+ * into bytes using the stream bitrate.
+ */
+typedef struct _JITTERBUF {
+    u_short jb_bitrate;         /*!< \brief Stream bitrate in kbit/s. */
+    u_short jb_lowat_ms;        /*!< \brief Low watermark in milliseconds. */
+    u_short jb_hiwat_ms;        /*!< \brief High watermark in milliseconds. */
+    u_long jb_bufsiz;           /*!< \brief Size of the segment buffer. */
+    u_long jb_lowat;            /*!< \brief Low watermark in bytes. */
+    u_long jb_hiwat;            /*!< \brief High watermark in bytes. */
+    u_char jb_state;            /*!< \brief Current state, see JB_PREROLL etc. */
+    u_long jb_underruns;        /*!< \brief Number of decoder underruns. */
+    u_long jb_rebuf_ms;         /*!< \brief Total time spent re-buffering. */
+    u_long jb_rebuf_start;      /*!< \brief Start time of the current fill. */
+} JITTERBUF;
+
+void JitterBufInit(JITTERBUF *jb, u_long bufsiz, u_short bitrate, u_short lowat_ms, u_short hiwat_ms);
+void JitterBufSetBitrate(JITTERBUF *jb, u_short bitrate);
+u_long JitterBufMillis(JITTERBUF *jb, u_long bytes);
+void JitterBufUpdate(JITTERBUF *jb);
+u_long JitterBufTimeout(JITTERBUF *jb);
+
+/*!
+ * \brief Connection to a radio station.
+ */
+typedef struct _STATION {
+    FILE *st_stream;            /*!< \brief Socket stream, used for the header. */
+    TCPSOCKET *st_sock;         /*!< \brief Socket of the connection. */
+    STREAMINFO st_info;         /*!< \brief Information from the response header. */
+} STATION;
+
+/*!
+ * \brief Context shared by the stream reader and the player thread.
+ */
+typedef struct _STREAMREADER {
+    STATION rd_cur;             /*!< \brief Station currently received. */
+    STATION rd_next;            /*!< \brief Standby station to switch to, old one after the switch. */
+    u_char rd_direct;           /*!< \brief Receive from the socket instead of the stream. */
+    u_char rd_metaseq;          /*!< \brief Last reported metadata sequence. */
+    JITTERBUF *rd_jb;           /*!< \brief Jitter buffer of the player. */
+    HANDLE rd_room;             /*!< \brief Posted by the player when the buffer drained. */
+    HANDLE rd_event;            /*!< \brief Posted by the reader on watermark crossings, and when a switch ends. */
+    HANDLE rd_swapped;          /*!< \brief Posted by the reader after switching stations. */
+    u_char rd_switch;           /*!< \brief Set to make the reader switch to rd_next. */
+    u_char rd_standby;          /*!< \brief StationSwitch() in progress, the player must not return. */
+    u_char rd_stalls;           /*!< \brief Consecutive windows below the bitrate. */
+    u_long rd_rx_bytes;         /*!< \brief Bytes received in the current window. */
+    u_long rd_rx_start;         /*!< \brief Start time of the current window. */
+    u_long rd_underruns;        /*!< \brief Decoder underruns before the current window. */
+    u_char rd_waiting;          /*!< \brief Reader is waiting for room. */
+    u_char rd_eof;              /*!< \brief Reader has terminated. */
+} STREAMREADER;
+
+/*!
+ * \brief Stream health counters, kept across connections.
+ */
+typedef struct _STREAMHEALTH {
+    u_long hl_errors;           /*!< \brief Connections closed or timed out. */
+    u_long hl_stalls;           /*!< \brief Receive rate fell below the bitrate. */
+    u_long hl_starved;          /*!< \brief Decoder repeatedly ran out of data. */
+    u_long hl_reconnects;       /*!< \brief Successful reconnects. */
+    u_long hl_failures;         /*!< \brief Failed reconnect attempts. */
+    u_long hl_recover_ms;       /*!< \brief Duration of the last recovery. */
+    u_long hl_recover_max;      /*!< \brief Longest recovery. */
+    u_long hl_recover_total;    /*!< \brief Total time spent recovering. */
+} STREAMHEALTH;
+
+CONST STREAMHEALTH *StreamHealth(void);
+void PlayMp3Stream(STATION *st);
+int StationSwitch(CONST char *url);
+int StationOpen(STATION *st, CONST char *url);
+int StationReopen(STATION *st);
+void StationClose(STATION *st);
+TCPSOCKET *CreateStationSocket(void);
+FILE *ConnectStation(TCPSOCKET *sock, u_long ip, u_short port, CONST char *host, CONST char *path, STREAMINFO *si);
 int ConfigureLan(char *devname);
 
 #endif
@@ -31,6 +31,8 @@
 #define LCD_BACKLIGHT_ON            1
 #define LCD_BACKLIGHT_OFF           0
 
+#define LCD_BAR_GLYPHS              8       // user-defined characters used by the bar graph
+
 #define ALL_ZERO          			0x00      // 0000 0000 B
 #define WRITE_COMMAND     			0x02      // 0000 0010 B
 #define WRITE_DATA        			0x03      // 0000 0011 B
@@ -54,6 +56,8 @@ extern void LcdBackLight(u_char);
 extern void LcdInit(void);
 extern void LcdLowLevelInit(void);
 extern void writeLcd(char text1[], char text2[]);
+extern void LcdBarInit(void);
+extern void LcdBarGraph(CONST u_char *Level, u_char Count, u_char Max);
 
 #endif /* _Display_H */
 /*    End Of File    */
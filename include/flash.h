@@ -32,6 +32,14 @@
 #define AT45DB0321B 5
 #define AT45DB0642  6
 
+/*
+ *  \brief last page of flash (264 bytes) can be dedicated for parameter storage
+ *   Special routines are provided for that goal but can be disabled here to save
+ *   codespace (about 360 bytes of code for GCC). Defined here, so users of the
+ *   routines see the prototypes. Needed by the tone control presets.
+ */
+#define USE_FLASH_PARAM_PAGE
+
 /*-------------------------------------------------------------------------*/
 /* typedefs & structs                                                      */
 /*-------------------------------------------------------------------------*/
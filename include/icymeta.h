@@ -0,0 +1,57 @@
+/* ========================================================================
+ * [PROJECT]    SIR
+ * [MODULE]     IcyMeta
+ * [TITLE]      ICY metadata demultiplexer header file
+ * [FILE]       icymeta.h
+ * [VSN]        1.0
+ * [CREATED]    17102026
+ * [LASTCHNGD]  17102026
+ * [COPYRIGHT]  Copyright (C) STREAMIT BV 2010
+ * [PURPOSE]    API and global defines for the ICY metadata demultiplexer
+ * ======================================================================== */
+
+#ifndef _IcyMeta_H
+#define _IcyMeta_H
+
+#include <sys/types.h>
+
+/*-------------------------------------------------------------------------*/
+/* global defines                                                          */
+/*-------------------------------------------------------------------------*/
+#define ICY_TITLE_SIZE      80      /* incl. terminating zero */
+#define ICY_URL_SIZE        64      /* incl. terminating zero */
+#define ICY_KEY_SIZE        12      /* longest key we care about is 'StreamTitle' */
+
+/*-------------------------------------------------------------------------*/
+/* typedefs & structs                                                      */
+/*-------------------------------------------------------------------------*/
+/*!
+ * \brief State of the ICY metadata demultiplexer.
+ *
+ * All buffers are part of the structure, so the demultiplexer never
+ * allocates memory while the stream is running.
+ */
+typedef struct _ICYMETA
+{
+    u_long  im_metaint;                 /* audio bytes between metadata blocks, 0 if none */
+    u_long  im_audioleft;               /* audio bytes left before the next length byte */
+    u_short im_metaleft;                /* metadata bytes left in the current block */
+    u_char  im_state;                   /* demultiplexer state */
+    u_char  im_pstate;                  /* key/value parser state */
+    u_char  im_keylen;                  /* number of characters in im_key */
+    u_char  im_vallen;                  /* number of characters in im_value */
+    char    im_key[ICY_KEY_SIZE];       /* key being parsed */
+    char    im_value[ICY_TITLE_SIZE];   /* value being parsed */
+    char    im_title[ICY_TITLE_SIZE];   /* last complete StreamTitle */
+    char    im_url[ICY_URL_SIZE];       /* last complete StreamUrl */
+    u_char  im_seq;                     /* incremented on every title update */
+    u_long  im_blocks;                  /* number of non-empty metadata blocks */
+} ICYMETA;
+
+/*-------------------------------------------------------------------------*/
+/* export global routines (interface)                                      */
+/*-------------------------------------------------------------------------*/
+extern void IcyMetaInit(ICYMETA *im, u_long metaint);
+extern size_t IcyMetaFilter(ICYMETA *im, u_char *buf, size_t len);
+
+#endif /* _IcyMeta_H */
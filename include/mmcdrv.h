@@ -48,6 +48,21 @@
 //
 #define MMC_SUPPORT_WRITE               1
 
+//
+// Transport to the card, selected at build time:
+// MMC_TRANSPORT_SPI    shared SPI unit through spidrv (default)
+// MMC_TRANSPORT_USART  USART1 in master SPI mode, double buffered.
+//                      Needs the card wired to RXD1/TXD1/XCK1. The
+//                      chip select stays on the shared line, so the
+//                      spidrv bus lock is still taken for every command
+//
+#define MMC_TRANSPORT_SPI               0
+#define MMC_TRANSPORT_USART             1
+
+#ifndef MMC_TRANSPORT
+#define MMC_TRANSPORT                   MMC_TRANSPORT_SPI
+#endif
+
 #define MMC_OK                          0x00
 #define MMC_ERROR                       0x01
 #define MMC_DRIVE_NOT_FOUND             0x02
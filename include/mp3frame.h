@@ -0,0 +1,99 @@
+/* ========================================================================
+ * [PROJECT]    SIR
+ * [MODULE]     Mp3Frame
+ * [TITLE]      MPEG audio frame synchronisation header file
+ * [FILE]       mp3frame.h
+ * [VSN]        1.0
+ * [CREATED]    17102026
+ * [LASTCHNGD]  17102026
+ * [COPYRIGHT]  Copyright (C) STREAMIT BV 2010
+ * [PURPOSE]    API and global defines for the MPEG audio frame sync stage
+ * ======================================================================== */
+
+#ifndef _Mp3Frame_H
+#define _Mp3Frame_H
+
+#include <sys/types.h>
+
+/*-------------------------------------------------------------------------*/
+/* global defines                                                          */
+/*-------------------------------------------------------------------------*/
+#define MP3_MPEG1           1
+#define MP3_MPEG2           2
+#define MP3_MPEG25          3       /* MPEG 2.5 */
+
+#define MP3_MODE_STEREO     0
+#define MP3_MODE_JOINT      1
+#define MP3_MODE_DUAL       2
+#define MP3_MODE_MONO       3
+
+#define MP3_SYNC_HUNT       0       /* searching for a frame header */
+#define MP3_SYNC_LOCKED     1       /* following frame boundaries */
+#define MP3_SYNC_BYPASS     2       /* not an MPEG audio stream, pass everything */
+
+/*!
+ * \brief give up hunting and pass data unmodified after this many bytes
+ *        without ever finding a frame.
+ */
+#ifndef MP3_SYNC_GIVEUP
+#define MP3_SYNC_GIVEUP     16384
+#endif
+
+/*!
+ * \brief weight of the last frame in the average bitrate, 1/2^n
+ */
+#define MP3_BRAVG_SHIFT     6
+
+/*-------------------------------------------------------------------------*/
+/* typedefs & structs                                                      */
+/*-------------------------------------------------------------------------*/
+/*!
+ * \brief Decoded MPEG audio frame header.
+ */
+typedef struct _MP3FRAMEINFO
+{
+    u_char  fi_version;                 /* MP3_MPEG1, MP3_MPEG2 or MP3_MPEG25 */
+    u_char  fi_layer;                   /* 1, 2 or 3 */
+    u_char  fi_mode;                    /* MP3_MODE_STEREO etc. */
+    u_short fi_bitrate;                 /* kbit/s */
+    u_short fi_samplerate;              /* Hz */
+    u_short fi_length;                  /* frame length in bytes, incl. header */
+} MP3FRAMEINFO;
+
+/*!
+ * \brief State of the frame sync stage.
+ *
+ * The stage works on the write window of the MP3 buffer. Junk is
+ * removed in place and an incomplete frame at the end of the window
+ * is held back, so only complete frames reach the decoder.
+ */
+typedef struct _MP3SYNC
+{
+    u_char  ms_state;                   /* MP3_SYNC_HUNT etc. */
+    u_char  ms_locked;                  /* set once the stream has ever been locked */
+    u_char  ms_changed;                 /* set when the format changed, cleared by caller */
+    u_char  ms_vbr;                     /* set when the bitrate varies between frames */
+    u_char  ms_ref[3];                  /* header bits that must not change within a stream */
+    u_short ms_frameleft;               /* bytes missing to complete the current frame */
+    u_short ms_held;                    /* bytes kept at the start of the next window */
+    u_short ms_scan;                    /* part of ms_held which has already been checked */
+    u_short ms_brmax;                   /* highest bitrate seen, kbit/s */
+    u_short ms_bravg;                   /* running average bitrate, kbit/s << MP3_BRAVG_SHIFT */
+    MP3FRAMEINFO ms_info;               /* header of the last frame */
+    u_long  ms_frames;                  /* number of frames passed */
+    u_long  ms_dropped;                 /* number of junk bytes removed */
+    u_long  ms_resyncs;                 /* number of times the sync was lost */
+    u_long  ms_hunted;                  /* bytes dropped before the first lock */
+} MP3SYNC;
+
+/*-------------------------------------------------------------------------*/
+/* export global routines (interface)                                      */
+/*-------------------------------------------------------------------------*/
+extern int Mp3FrameHeader(CONST u_char *cp, MP3FRAMEINFO *fi);
+extern void Mp3SyncInit(MP3SYNC *ms);
+extern void Mp3SyncRestart(MP3SYNC *ms);
+extern size_t Mp3SyncFilter(MP3SYNC *ms, u_char *buf, size_t len);
+extern size_t Mp3SyncFlush(MP3SYNC *ms);
+extern void Mp3SyncReport(MP3SYNC *ms);
+
+#endif /* _Mp3Frame_H */
@@ -0,0 +1,67 @@
+/* ========================================================================
+ * [PROJECT]    SIR
+ * [MODULE]     Playlist
+ * [TITLE]      stream playlist header file
+ * [FILE]       playlist.h
+ * [VSN]        1.0
+ * [CREATED]    17102026
+ * [LASTCHNGD]  17102026
+ * [COPYRIGHT]  Copyright (C) STREAMIT BV 2010
+ * [PURPOSE]    API and global defines for the stream URL table and the
+ *              .pls/.m3u playlist parser
+ * ======================================================================== */
+
+#ifndef _Playlist_H
+#define _Playlist_H
+
+#include <sys/types.h>
+
+/*-------------------------------------------------------------------------*/
+/* global defines                                                          */
+/*-------------------------------------------------------------------------*/
+#define PL_MAX_URLS         4       /* candidate stream URLs kept */
+#define PL_URL_SIZE         96      /* incl. terminating zero */
+#define PL_WINDOW_SIZE      8       /* line prefix, long enough for 'http://' */
+
+/*!
+ * \brief maximum size of a playlist file
+ */
+#ifndef PL_MAXSIZE
+#define PL_MAXSIZE          4096
+#endif
+
+#define PL_NONE             0       /* not a playlist */
+#define PL_PLS              1       /* Shoutcast/Winamp .pls */
+#define PL_M3U              2       /* .m3u */
+
+/*-------------------------------------------------------------------------*/
+/* typedefs & structs                                                      */
+/*-------------------------------------------------------------------------*/
+/*!
+ * \brief Table of candidate stream URLs and playlist parser state.
+ *
+ * The parser is fed one character at a time and copies URLs directly
+ * into the table, .pls and .m3u are handled by the same parser.
+ */
+typedef struct _PLAYLIST
+{
+    char    pl_url[PL_MAX_URLS][PL_URL_SIZE];
+    u_char  pl_count;                   /* number of valid entries */
+    u_char  pl_current;                 /* entry returned by PlaylistNext() */
+    u_char  pl_state;                   /* parser state */
+    u_char  pl_len;                     /* characters in window or URL */
+    u_short pl_total;                   /* characters parsed */
+    char    pl_win[PL_WINDOW_SIZE];     /* start of the current line */
+} PLAYLIST;
+
+/*-------------------------------------------------------------------------*/
+/* export global routines (interface)                                      */
+/*-------------------------------------------------------------------------*/
+extern void PlaylistInit(PLAYLIST *pl);
+extern int PlaylistAdd(PLAYLIST *pl, CONST char *url);
+extern int PlaylistPut(PLAYLIST *pl, char ch);
+extern CONST char *PlaylistNext(PLAYLIST *pl);
+extern u_char PlaylistType(CONST char *type, CONST char *path);
+extern int PlaylistSplitUrl(char *url, char **host, u_short *port, char **path);
+
+#endif /* _Playlist_H */
@@ -21,6 +21,12 @@
 #define SPEED_FAST         1
 #define SPEED_ULTRA_FAST   2
 
+/*
+ * define to build SPIbenchmark(), which logs the cycles per byte of the
+ * transfer routines at startup
+ */
+//#define SPI_BENCHMARK
+
 /*-------------------------------------------------------------------------*/
 /* typedefs & structs                                                      */
 /*-------------------------------------------------------------------------*/
@@ -29,6 +35,7 @@ typedef enum
     SPI_DEV_VS10XX=0,
     SPI_DEV_FLASH,
     SPI_DEV_MMC,
+    SPI_DEV_VS10XX_CMD,     // VS10XX command interface (SCI), fixed slow speed
 
     SPI_NROF_DEVICES        // keep last
 }TSPIDevice;
@@ -41,12 +48,21 @@ typedef enum
 /*-------------------------------------------------------------------------*/
 extern void SPIselect(TSPIDevice Device);
 extern void SPIdeselect(void);
+extern void SPIbegin(TSPIDevice Device);    // acquire the bus and select device
+extern void SPIend(void);                   // deselect and release the bus
+extern u_char SPIbusy(void);                // bus held by a thread
 extern void SPIputByte(u_char bByte);       // send byte using SPI, ignore result
 extern u_char SPIgetByte(void);             // read byte using SPI, don't use any input
 extern u_char SPItransferByte(u_char);      // send byte using SPI, return result
+extern void SPIwriteBlock(CONST u_char *pData, u_short wLen);  // send block, ignore result
+extern void SPIreadBlock(u_char *pData, u_short wLen);          // read block, send 0xFF
+extern void SPIexchangeBlock(CONST u_char *pTx, u_char *pRx, u_short wLen); // send and read block
 extern void SPIinit(void);                  // initialise SPI-registers (speed, mode)
 extern void SPImode(u_char data);
 extern u_char SPIgetmode(void);
+#ifdef SPI_BENCHMARK
+extern void SPIbenchmark(void);
+#endif
 
 #endif /* _SPI_H */
 /*    End Of File    */
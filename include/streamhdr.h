@@ -0,0 +1,77 @@
+/* ========================================================================
+ * [PROJECT]    SIR
+ * [MODULE]     StreamHdr
+ * [TITLE]      stream response header parser header file
+ * [FILE]       streamhdr.h
+ * [VSN]        1.0
+ * [CREATED]    17102026
+ * [LASTCHNGD]  17102026
+ * [COPYRIGHT]  Copyright (C) STREAMIT BV 2010
+ * [PURPOSE]    API and global defines for the HTTP/ICY response header parser
+ * ======================================================================== */
+
+#ifndef _StreamHdr_H
+#define _StreamHdr_H
+
+#include <sys/types.h>
+
+/*-------------------------------------------------------------------------*/
+/* global defines                                                          */
+/*-------------------------------------------------------------------------*/
+#define SH_NAME_SIZE        32      /* incl. terminating zero */
+#define SH_TYPE_SIZE        24      /* incl. terminating zero */
+#define SH_LOCATION_SIZE    96      /* incl. terminating zero */
+#define SH_WINDOW_SIZE      16      /* status line prefix and header names */
+
+/*!
+ * \brief maximum total size of a response header
+ */
+#ifndef SH_MAXHEADER
+#define SH_MAXHEADER        4096
+#endif
+
+#define SH_MORE             0       /* header not complete yet */
+#define SH_DONE             1       /* empty line received */
+#define SH_ERROR            (-1)    /* malformed or oversized header */
+
+/*-------------------------------------------------------------------------*/
+/* typedefs & structs                                                      */
+/*-------------------------------------------------------------------------*/
+/*!
+ * \brief Information extracted from the response header.
+ */
+typedef struct _STREAMINFO
+{
+    u_short si_status;                  /* status code, e.g. 200 */
+    u_short si_bitrate;                 /* icy-br in kbit/s, 0 if unknown */
+    u_long  si_metaint;                 /* icy-metaint, 0 if no metadata */
+    char    si_name[SH_NAME_SIZE];      /* icy-name */
+    char    si_type[SH_TYPE_SIZE];      /* content-type */
+    char    si_location[SH_LOCATION_SIZE];  /* Location of a redirect */
+} STREAMINFO;
+
+/*!
+ * \brief State of the header parser.
+ *
+ * The parser is fed one character at a time and never keeps more than
+ * SH_WINDOW_SIZE characters of a line. Values are stored directly in
+ * the STREAMINFO fields.
+ */
+typedef struct _STREAMHDR
+{
+    STREAMINFO *sh_info;                /* receives the results */
+    u_short sh_total;                   /* characters received so far */
+    u_char  sh_state;                   /* parser state */
+    u_char  sh_field;                   /* field of the current line */
+    u_char  sh_len;                     /* characters in window or value */
+    u_char  sh_end;                     /* value length without trailing blanks */
+    char    sh_win[SH_WINDOW_SIZE];     /* status line prefix or header name */
+} STREAMHDR;
+
+/*-------------------------------------------------------------------------*/
+/* export global routines (interface)                                      */
+/*-------------------------------------------------------------------------*/
+extern void StreamHdrInit(STREAMHDR *sh, STREAMINFO *si);
+extern int StreamHdrPut(STREAMHDR *sh, char ch);
+
+#endif /* _StreamHdr_H */
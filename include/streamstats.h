@@ -0,0 +1,64 @@
+/* ========================================================================
+ * [PROJECT]    SIR
+ * [MODULE]     StreamStats
+ * [TITLE]      playback telemetry header file
+ * [FILE]       streamstats.h
+ * [VSN]        1.0
+ * [CREATED]    17102026
+ * [LASTCHNGD]  17102026
+ * [COPYRIGHT]  Copyright (C) STREAMIT BV 2010
+ * [PURPOSE]    API and global defines for the playback statistics
+ * ======================================================================== */
+
+#ifndef _StreamStats_H
+#define _StreamStats_H
+
+#include <stdio.h>
+#include <sys/types.h>
+
+/*-------------------------------------------------------------------------*/
+/* global defines                                                          */
+/*-------------------------------------------------------------------------*/
+#define SS_HIST_BUCKETS     8       /* buffer occupancy in eighths */
+#define SS_RATE_WINDOW      1000    /* throughput window in ms */
+
+/*-------------------------------------------------------------------------*/
+/* typedefs & structs                                                      */
+/*-------------------------------------------------------------------------*/
+/*!
+ * \brief Playback statistics.
+ *
+ * Counters are updated by plain increments from thread context only.
+ * Nut/OS threads are not preempted by each other, so no locking is
+ * needed, neither for updates nor for the CGI reading them.
+ */
+typedef struct _STREAMSTATS
+{
+    u_long  ss_start;                   /* start of playback, ms */
+    u_long  ss_rx_bytes;                /* bytes received */
+    u_long  ss_win_start;               /* start of the throughput window */
+    u_long  ss_win_bytes;               /* bytes received in this window */
+    u_short ss_kbps;                    /* throughput of the last window */
+    u_long  ss_hist_last;               /* time of the last level sample */
+    u_long  ss_hist[SS_HIST_BUCKETS];   /* ms spent at each buffer level */
+    u_long  ss_underruns;               /* decoder ran out of data */
+    u_long  ss_kicks;                   /* decoder (re-)starts */
+    u_long  ss_metablocks;              /* ICY metadata blocks received */
+    u_long  ss_reconnects;              /* stream reconnects */
+} STREAMSTATS;
+
+/*-------------------------------------------------------------------------*/
+/* export global variables                                                 */
+/*-------------------------------------------------------------------------*/
+extern STREAMSTATS streamstats;
+
+/*-------------------------------------------------------------------------*/
+/* export global routines (interface)                                      */
+/*-------------------------------------------------------------------------*/
+extern void StreamStatsInit(void);
+extern void StreamStatsRx(size_t bytes);
+extern void StreamStatsLevel(u_long used, u_long size);
+extern u_short StreamStatsAverage(void);
+extern void StreamStatsPrint(FILE *stream, u_char json);
+
+#endif /* _StreamStats_H */
@@ -0,0 +1,49 @@
+/* ========================================================================
+ * [PROJECT]    SIR
+ * [MODULE]     ToneCtrl
+ * [TITLE]      bass/treble presets header file
+ * [FILE]       tonectrl.h
+ * [VSN]        1.0
+ * [CREATED]    17102026
+ * [LASTCHNGD]  17102026
+ * [COPYRIGHT]  Copyright (C) STREAMIT BV 2010
+ * [PURPOSE]    API and global defines for the tone control presets
+ * ======================================================================== */
+
+#ifndef _ToneCtrl_H
+#define _ToneCtrl_H
+
+#include <sys/types.h>
+
+#include "vs10xx.h"
+
+/*-------------------------------------------------------------------------*/
+/* global defines                                                          */
+/*-------------------------------------------------------------------------*/
+#define TONE_PRESET_FLAT    0
+#define TONE_PRESET_BASS    1
+#define TONE_PRESET_TREBLE  2
+#define TONE_PRESET_LOUD    3
+#define TONE_PRESET_VOICE   4
+#define TONE_PRESET_CUSTOM  5       /* settings given by ToneCtrlSetCustom() */
+#define TONE_PRESETS        6
+
+/*!
+ * \brief location of the tone settings in the flash parameter page
+ */
+#define TONE_PARAM_POS      0
+
+/*-------------------------------------------------------------------------*/
+/* typedefs & structs                                                      */
+/*-------------------------------------------------------------------------*/
+
+/*-------------------------------------------------------------------------*/
+/* export global routines (interface)                                      */
+/*-------------------------------------------------------------------------*/
+extern int ToneCtrlInit(void);
+extern int ToneCtrlSelect(u_char preset);
+extern int ToneCtrlSetCustom(CONST VSTONECTRL *tc);
+extern u_char ToneCtrlCurrent(void);
+extern PGM_P ToneCtrlName(u_char preset);
+
+#endif /* _ToneCtrl_H */
@@ -128,9 +128,45 @@
 #define VS_STATUS_EOF       2
 #define VS_STATUS_EMPTY     4
 
+// Volume register level for silence, levels are in 0.5 dB steps
+#define VS_VOL_MUTE         0xFE
+
+// Maximum number of spectrum analyzer bands read from the decoder
+#define VS_SA_MAX_BANDS     16
+
+// Tone queue, frequency of a rest and predefined sounds
+#define VS_TONE_REST        0xFF
+
+#define VS_SOUND_CLICK      0
+#define VS_SOUND_ERROR      1
+#define VS_SOUND_ALARM      2
+
 /*-------------------------------------------------------------------------*/
 /* typedefs & structs                                                      */
 /*-------------------------------------------------------------------------*/
+/*!
+ * \brief Bass and treble settings, packed into SCI_BASS.
+ */
+typedef struct _VSTONECTRL
+{
+    signed char tc_treble;              /* -8..7, in 1.5 dB steps, 0 is off */
+    u_char  tc_treble_khz;              /* 1..15, treble boost above this frequency */
+    u_char  tc_bass;                    /* 0..15 dB, 0 is off */
+    u_char  tc_bass_hz10;               /* 2..15, bass boost below 10 times this frequency */
+} VSTONECTRL;
+
+/*!
+ * \brief Stream properties as seen by the decoder.
+ */
+typedef struct _VSDECODERINFO
+{
+    u_short di_format;                  /* HDAT1, 0xFFE0 for MP3, 0 if not decoding */
+    u_short di_bitrate;                 /* kbit/s, 0 if unknown */
+    u_short di_samplerate;              /* Hz */
+    u_char  di_channels;                /* 1 or 2 */
+    u_short di_time;                    /* seconds decoded since the last reset */
+    u_long  di_stamp;                   /* NutGetMillis() when sampled, 0 if never */
+} VSDECODERINFO;
 
 /*-------------------------------------------------------------------------*/
 /* export global variables                                                 */
@@ -143,6 +179,7 @@ extern int VsPlayerInit(void);
 extern int VsPlayerReset(u_short mode);
 extern int VsPlayerSetMode(u_short mode);
 extern int VsPlayerKick(void);
+extern void VsPlayerRefill(void);
 extern int VsPlayerStop(void);
 extern u_char VsPlayerInterrupts(u_char enable);
 
@@ -152,13 +189,29 @@ extern u_short VsGetType(void);
 extern u_short VsGetTypeHex(void);
 extern int VsSetVolume(u_char left, u_char right);
 extern u_short VsGetVolume(void);
+extern int VsVolumeRamp(u_char left, u_char right, u_short ms);
+extern int VsFadeIn(u_short ms);
+extern int VsFadeOut(u_short ms);
+extern int VsDuck(u_char att, u_short ms);
 extern int VsBeep(u_char fsin, u_short ms);
 extern int VsBeepStart(u_char fsin);
 extern int VsBeepStartRaw(u_char Raw);
 extern int VsBeepStop(void);
+extern int VsToneQueue(u_char fsin, u_short ms);
+extern int VsToneQueueRaw(u_char raw, u_short ms);
+extern int VsToneSound(u_char sound);
+extern void VsToneClear(void);
 extern u_short VsRegInfo(u_char reg);
 extern void VsRegWrite(u_char reg, u_short data);
 extern u_short VsStreamValid(void);
+extern int VsSetTone(CONST VSTONECTRL *tc);
+extern void VsGetTone(VSTONECTRL *tc);
+extern int VsDecoderSample(void);
+extern int VsDecoderInfo(VSDECODERINFO *di);
+extern int VsPluginLoad(CONST u_short *plugin, u_short words);
+extern int VsSpectrumStart(CONST u_short *plugin, u_short words);
+extern void VsSpectrumStop(void);
+extern int VsSpectrumRead(u_char *level, u_char max);
 
 
 /*@}*/
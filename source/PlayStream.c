@@ -46,7 +46,6 @@
 #else
 #include <dev/nicrtl.h>
 #endif
-#include <dev/vs1001k.h>
 
 #include <sys/version.h>
 #include <sys/confnet.h>
@@ -57,11 +56,18 @@
 
 #include <sys/socket.h>
 #include <arpa/inet.h>
+#include <netdb.h>
 #include <net/route.h>
 #include <netinet/tcp.h>
 #include <PlayStream.h> 
 #include <pro/dhcp.h>
 
+#include "vs10xx.h"
+#include "icymeta.h"
+#include "mp3frame.h"
+#include "playlist.h"
+#include "streamstats.h"
+
 /*
  * Determine the compiler.
  */
@@ -121,31 +127,35 @@
 #define MY_IPGATE "192.168.192.1"
 
 /*!
- * \brief IP address of the radio station.
- */
-#define RADIO_IPADDR "82.201.100.10"
-//#define RADIO_IPADDR "64.236.34.196"
-
-/*!
- * \brief Port number of the radio station.
+ * \brief URL of the radio station.
+ *
+ * May point to the stream itself or to a .pls or .m3u playlist.
  */
-#define RADIO_PORT 8000
+#define RADIO_URL "http://82.201.100.10:8000/SLAMFM_MP3_HQ"
+//#define RADIO_URL "http://64.236.34.196:8000/stream/1020"
 
 /*!
- * \brief URL of the radio station.
+ * \brief Maximum number of HTTP redirects followed.
  */
-#define RADIO_URL "/SLAMFM_MP3_HQ"
-//#define RADIO_URL "/stream/1020"
+#define MAX_REDIRECTS 5
 
 /*!
- * \brief Size of the header line buffer.
+ * \brief Initial TCP receive window.
+ *
+ * Used while connecting. Adjusted by StreamBufferInit() as soon as the
+ * MP3 buffer has been sized.
  */
-#define MAX_HEADERLINE 512
+#define TCPIP_BUFSIZ 8760
 
 /*!
- * \brief TCP buffer size.
+ * \brief Limits of the TCP receive window while playing.
+ *
+ * The MP3 buffer holds the audio, so the window only needs to cover
+ * the network round trip. Memory for the window is not taken from the
+ * MP3 buffer budget.
  */
-#define TCPIP_BUFSIZ 87600
+#define TCPIP_MIN_RCVBUF 5840
+#define TCPIP_MAX_RCVBUF 11680
 
 /*!
  * \brief Maximum segment size. 
@@ -161,6 +171,152 @@
  */
 #define TCPIP_READTIMEOUT 3000
 
+/*!
+ * \brief Amount of audio the MP3 buffer should hold in milliseconds.
+ *
+ * On boards without banked memory the buffer is limited by the heap.
+ */
+#define MP3_BUFFER_MS 5000
+
+/*!
+ * \brief Minimum size of the MP3 buffer.
+ */
+#define MP3_MIN_BUFSIZ 8192
+
+/*!
+ * \brief Heap space left for other threads, e.g. the HTTP server.
+ */
+#define MP3_HEAP_RESERVE 8192
+
+/*!
+ * \brief Bitrate assumed when the server doesn't announce one, in kbit/s.
+ */
+#define JB_DEFAULT_BITRATE 128
+
+/*!
+ * \brief Jitter buffer low watermark in milliseconds of audio.
+ *
+ * Below this level the receiver reads as fast as the network allows.
+ */
+#define JB_LOWAT_MS 500
+
+/*!
+ * \brief Jitter buffer high watermark in milliseconds of audio.
+ *
+ * The decoder is (re-)started as soon as this amount of audio is
+ * buffered. It is clamped to 3/4 of the segment buffer.
+ */
+#define JB_HIWAT_MS 2000
+
+/*!
+ * \brief Upper limit of a single player wait in milliseconds.
+ *
+ * The player thread checks the decoder status at least this often.
+ */
+#define JB_MAX_WAIT 1000
+
+/*!
+ * \brief Fade-in time in milliseconds when the decoder is (re-)started.
+ *
+ * Avoids the click of audio starting at full volume after an underrun.
+ */
+#define JB_FADE_MS 300
+
+/*!
+ * \brief Receive audio data directly from the socket.
+ *
+ * If defined, the reader calls NutTcpReceive() into the MP3 buffer
+ * after the header has been read. Otherwise audio data is read through
+ * the stdio stream, which copies every byte once more.
+ */
+#define USE_DIRECT_RECV
+
+/*!
+ * \brief Stack size of the stream reader thread.
+ */
+#define READER_STACK 1536
+
+/*!
+ * \brief Length of the receive rate measurement window in milliseconds.
+ */
+#define SUP_WINDOW_MS 5000
+
+/*!
+ * \brief Minimum receive rate in percent of the bitrate.
+ *
+ * Time spent waiting for room in a full buffer is not measured.
+ */
+#define SUP_MIN_RATE 90
+
+/*!
+ * \brief Number of consecutive slow windows treated as a stall.
+ */
+#define SUP_STALL_WINDOWS 2
+
+/*!
+ * \brief Number of decoder underruns within one window treated as a stall.
+ */
+#define SUP_MAX_UNDERRUNS 3
+
+/*!
+ * \brief Reconnect delays in milliseconds.
+ *
+ * The delay doubles with each failed attempt, up to the maximum. The
+ * actual wait is randomized between half and the full delay, so that
+ * many receivers don't hit the server at the same time.
+ */
+#define SUP_BACKOFF_MIN 500
+#define SUP_BACKOFF_MAX 60000
+
+/*!
+ * \brief Number of reconnect attempts before giving up, 0 retries forever.
+ */
+#define SUP_MAX_RETRIES 0
+
+/*!
+ * \brief Maximum time to pre-buffer a new station in milliseconds.
+ *
+ * When switching stations, the new connection fills its TCP receive
+ * window while the old station keeps playing.
+ */
+#define SWITCH_PREBUF_TIMEOUT 3000
+
+/*
+ * Metadata demultiplexer of the running stream.
+ */
+static ICYMETA icymeta;
+
+/*
+ * Frame sync stage of the running stream.
+ */
+static MP3SYNC mp3sync;
+
+/*
+ * Reader of the running stream, 0 if not playing.
+ */
+static STREAMREADER *reader;
+
+/*
+ * Candidate stream URLs of the current station.
+ */
+static PLAYLIST playlist;
+
+/*
+ * Stream health counters.
+ */
+static STREAMHEALTH health;
+
+/*
+ * Size of the MP3 buffer and of the TCP window, set by StreamBufferInit().
+ */
+static u_long mp3_bufsiz;
+static u_short tcp_rcvbuf = TCPIP_BUFSIZ;
+
+/*
+ * Bitrate last reported by the decoder, kbit/s.
+ */
+static u_short decoder_kbps;
+
 
  /*!
  * \brief Configure Ethernut LAN interface.
@@ -235,22 +391,57 @@ int ConfigureLan(char *devname)
     return 0;
 }
 
+/*!
+ * \brief Create a TCP socket for a radio station connection.
+ *
+ * Socket option failures are ignored.
+ *
+ * \return Pointer to the socket or 0 if out of memory.
+ */
+TCPSOCKET *CreateStationSocket(void)
+{
+    TCPSOCKET *sock;
+    u_short tcpbufsiz = tcp_rcvbuf;
+    u_long rx_to = TCPIP_READTIMEOUT;
+    u_short mss = TCPIP_MSS;
+
+    if ((sock = NutTcpCreateSocket()) == 0) {
+        puts("Error: Can't create socket");
+        return 0;
+    }
+    if (NutTcpSetSockOpt(sock, TCP_MAXSEG, &mss, sizeof(mss)))
+        printf("Sockopt MSS failed\n");
+    if (NutTcpSetSockOpt(sock, SO_RCVTIMEO, &rx_to, sizeof(rx_to)))
+        printf("Sockopt TO failed\n");
+    if (NutTcpSetSockOpt(sock, SO_RCVBUF, &tcpbufsiz, sizeof(tcpbufsiz)))
+        printf("Sockopt rxbuf failed\n");
+
+    return sock;
+}
+
 /*!
  * \brief Connect to a radio station.
  *
- * \param sock TCP socket for this connection.
- * \param ip   IP address of the server to connect.
- * \param port Port number of the server to connect.
+ * \param sock    TCP socket for this connection.
+ * \param ip      IP address of the server to connect.
+ * \param port    Port number of the server to connect.
+ * \param host    Host name sent in the request.
+ * \param path    Path of the request, without leading slash.
+ * \param si      Receives the information from the response header.
+ *                Contains the status code and location of a redirect
+ *                even if 0 is returned.
  *
  * \return Stream pointer of the established connection on success.
  *         Otherwise 0 is returned.
  */
-FILE *ConnectStation(TCPSOCKET *sock, u_long ip, u_short port, u_long *metaint)
+FILE *ConnectStation(TCPSOCKET *sock, u_long ip, u_short port, CONST char *host, CONST char *path, STREAMINFO *si)
 {
     int rc;
     FILE *stream;
-    u_char *line;
-    u_char *cp;
+    STREAMHDR sh;
+    int ch;
+
+    memset(si, 0, sizeof(STREAMINFO));
 
     /* 
      * Connect the TCP server. 
@@ -270,9 +461,13 @@ FILE *ConnectStation(TCPSOCKET *sock, u_long ip, u_short port, u_long *metaint)
     /*
      * Send the HTTP request.
      */
-    printf("GET %s HTTP/1.0\n\n", RADIO_URL);
-    fprintf(stream, "GET %s HTTP/1.0\r\n", RADIO_URL);
-    fprintf(stream, "Host: %s\r\n", inet_ntoa(ip));
+    printf("GET /%s HTTP/1.0\n\n", path);
+    fprintf(stream, "GET /%s HTTP/1.0\r\n", path);
+    if (port == 80) {
+        fprintf(stream, "Host: %s\r\n", host);
+    } else {
+        fprintf(stream, "Host: %s:%u\r\n", host, port);
+    }
     fprintf(stream, "User-Agent: Ethernut\r\n");
     fprintf(stream, "Accept: */*\r\n");
     fprintf(stream, "Icy-MetaData: 1\r\n");
@@ -281,108 +476,843 @@ FILE *ConnectStation(TCPSOCKET *sock, u_long ip, u_short port, u_long *metaint)
     fflush(stream);
 
     /*
-     * Receive the HTTP header.
+     * Receive the response header. The parser gets one character at
+     * a time, so no line buffer is needed.
      */
-    line = malloc(MAX_HEADERLINE);
-    while(fgets(line, MAX_HEADERLINE, stream)) {
+    StreamHdrInit(&sh, si);
+    rc = SH_MORE;
+    while (rc == SH_MORE && (ch = fgetc(stream)) != EOF) {
+        rc = StreamHdrPut(&sh, (char) ch);
+    }
+    if (rc != SH_DONE) {
+        puts("Error: Bad response header");
+        fclose(stream);
+        return 0;
+    }
+    printf("Status %u, %s, %s, %u kbit/s, metaint %lu\n", si->si_status, si->si_name,
+        si->si_type, si->si_bitrate, si->si_metaint);
+    if (si->si_status < 200 || si->si_status > 299) {
+        if (si->si_location[0]) {
+            printf("Location: %s\n", si->si_location);
+        }
+        fclose(stream);
+        return 0;
+    }
+    putchar('\n');
 
-        /*
-         * Chop off the carriage return at the end of the line. If none
-         * was found, then this line was probably too large for our buffer.
-         */
-        cp = strchr(line, '\r');
-        if(cp == 0) {
-            puts("Warning: Input buffer overflow");
-            continue;
+    return stream;
+}
+
+/*!
+ * \brief Connect to a stream URL.
+ *
+ * Follows up to MAX_REDIRECTS redirects. If the URL points to a
+ * playlist, the playlist is loaded into the URL table.
+ *
+ * \param st  Receives the connection.
+ * \param pl  URL table to load a playlist into.
+ * \param url URL to connect.
+ *
+ * \return 0 if connected to a stream, 1 if a playlist has been loaded
+ *         or -1 on failure.
+ */
+static int StationConnectUrl(STATION *st, PLAYLIST *pl, CONST char *url)
+{
+    char buf[PL_URL_SIZE];
+    char *host;
+    char *path;
+    u_short port;
+    u_long ip;
+    u_char hops;
+    int ch;
+
+    for (hops = 0; hops <= MAX_REDIRECTS; hops++) {
+        if (strlen(url) >= sizeof(buf)) {
+            return -1;
+        }
+        strcpy(buf, url);
+        if (PlaylistSplitUrl(buf, &host, &port, &path)) {
+            printf("Error: Bad URL %s\n", url);
+            return -1;
+        }
+        if ((ip = inet_addr(host)) == (u_long) -1 && (ip = NutDnsGetHostByName((u_char *) host)) == 0) {
+            printf("Error: Can't resolve %s\n", host);
+            return -1;
+        }
+
+        if ((st->st_sock = CreateStationSocket()) == 0) {
+            return -1;
+        }
+        if ((st->st_stream = ConnectStation(st->st_sock, ip, port, host, path, &st->st_info)) != 0) {
+            if (PlaylistType(st->st_info.si_type, path) == PL_NONE) {
+                return 0;
+            }
+
+            /*
+             * Replace the URL table by the playlist entries.
+             */
+            PlaylistInit(pl);
+            while ((ch = fgetc(st->st_stream)) != EOF && PlaylistPut(pl, (char) ch) == 0);
+            PlaylistPut(pl, '\n');
+            fclose(st->st_stream);
+            NutTcpCloseSocket(st->st_sock);
+            return pl->pl_count ? 1 : -1;
         }
-        *cp = 0;
+        NutTcpCloseSocket(st->st_sock);
 
         /*
-         * The header is terminated by an empty line.
+         * Follow redirects. The location is copied before the next
+         * request overwrites it.
          */
-        if(*line == 0) {
+        if (st->st_info.si_status < 300 || st->st_info.si_status > 399 || st->st_info.si_location[0] == 0) {
+            return -1;
+        }
+        url = st->st_info.si_location;
+    }
+    puts("Error: Too many redirects");
+
+    return -1;
+}
+
+/*
+ * \brief Connect to the next candidate of a URL table.
+ *
+ * Tries each entry once, starting with the one following the last
+ * connected.
+ *
+ * \param st Receives the connection.
+ * \param pl URL table.
+ *
+ * \return 0 on success, -1 if no candidate could be connected.
+ */
+static int StationConnectNext(STATION *st, PLAYLIST *pl)
+{
+    CONST char *url;
+    u_char tries;
+    u_char loaded = 0;
+    int rc;
+
+    for (tries = 0; tries < pl->pl_count; tries++) {
+        if ((url = PlaylistNext(pl)) == 0) {
             break;
         }
-        if(strncmp(line, "icy-metaint:", 12) == 0) {
-            *metaint = atol(line + 12);
+        rc = StationConnectUrl(st, pl, url);
+        if (rc == 0) {
+            return 0;
+        }
+
+        /*
+         * Start over with the entries of a playlist, but don't load
+         * playlists pointing to playlists.
+         */
+        if (rc > 0) {
+            if (loaded++) {
+                break;
+            }
+            tries = (u_char) -1;
         }
-        printf("%s\n", line);
     }
-    putchar('\n');
+    memset(st, 0, sizeof(STATION));
 
-    free(line);
+    return -1;
+}
 
-    return stream;
+/*!
+ * \brief Connect to the next candidate of the current station.
+ *
+ * Tries each entry of the URL table once, starting with the one
+ * following the last connected. Used to fail over between the
+ * servers of a playlist without loading it again.
+ *
+ * \param st Receives the connection.
+ *
+ * \return 0 on success, -1 if no candidate could be connected.
+ */
+int StationReopen(STATION *st)
+{
+    return StationConnectNext(st, &playlist);
+}
+
+/*!
+ * \brief Connect to a station.
+ *
+ * \param st  Receives the connection.
+ * \param url URL of the stream or of a .pls or .m3u playlist.
+ *
+ * \return 0 on success, -1 otherwise.
+ */
+int StationOpen(STATION *st, CONST char *url)
+{
+    PlaylistInit(&playlist);
+    if (PlaylistAdd(&playlist, url)) {
+        return -1;
+    }
+    return StationConnectNext(st, &playlist);
+}
+
+/*!
+ * \brief Close a station connection.
+ *
+ * \param st Connection to close, may be closed already.
+ */
+void StationClose(STATION *st)
+{
+    if (st->st_stream) {
+        fclose(st->st_stream);
+    }
+    if (st->st_sock) {
+        NutTcpCloseSocket(st->st_sock);
+    }
+    memset(st, 0, sizeof(STATION));
 }
 
 /*
- * Process embedded meta data.
+ * \brief Number of bytes received on a station connection and not read yet.
  */
-int ProcessMetaData(FILE *stream)
+static u_short StationBuffered(STATION *st)
 {
-    u_char blks = 0;
-    u_short cnt;
-    int got;
-    int rc = 0;
-    u_char *mbuf;
+    return st->st_sock->so_rx_cnt;
+}
+
+/*!
+ * \brief Initialize the jitter buffer controller.
+ *
+ * Converts the watermarks from milliseconds of audio into bytes,
+ * based on the stream bitrate.
+ *
+ * \param jb       Controller to initialize.
+ * \param bufsiz   Total size of the segment buffer.
+ * \param bitrate  Stream bitrate in kbit/s, 0 if unknown.
+ * \param lowat_ms Low watermark in milliseconds.
+ * \param hiwat_ms High watermark in milliseconds.
+ */
+void JitterBufInit(JITTERBUF *jb, u_long bufsiz, u_short bitrate, u_short lowat_ms, u_short hiwat_ms)
+{
+    memset(jb, 0, sizeof(JITTERBUF));
+
+    jb->jb_bufsiz = bufsiz;
+    jb->jb_lowat_ms = lowat_ms;
+    jb->jb_hiwat_ms = hiwat_ms;
+    JitterBufSetBitrate(jb, bitrate);
+
+    jb->jb_state = JB_PREROLL;
+    jb->jb_rebuf_start = NutGetMillis();
+}
+
+/*!
+ * \brief Recalculate the watermarks for a new bitrate.
+ *
+ * Called by JitterBufInit() with the announced bitrate and again when
+ * the frame sync detected the real one.
+ *
+ * \param jb      Jitter buffer controller.
+ * \param bitrate Stream bitrate in kbit/s, 0 if unknown.
+ */
+void JitterBufSetBitrate(JITTERBUF *jb, u_short bitrate)
+{
+    if (bitrate == 0) {
+        bitrate = JB_DEFAULT_BITRATE;
+    }
+    jb->jb_bitrate = bitrate;
+
+    /* One kbit/s equals one bit per millisecond. */
+    jb->jb_hiwat = ((u_long) jb->jb_hiwat_ms * bitrate) / 8;
+    if (jb->jb_hiwat > (jb->jb_bufsiz / 4) * 3) {
+        jb->jb_hiwat = (jb->jb_bufsiz / 4) * 3;
+    }
+    jb->jb_lowat = ((u_long) jb->jb_lowat_ms * bitrate) / 8;
+    if (jb->jb_lowat > jb->jb_hiwat / 2) {
+        jb->jb_lowat = jb->jb_hiwat / 2;
+    }
+
+    printf("Jitter buffer %lu/%lu bytes at %u kbit/s\n", jb->jb_lowat, jb->jb_hiwat, bitrate);
+}
+
+/*!
+ * \brief Convert a number of buffered bytes into milliseconds of audio.
+ */
+u_long JitterBufMillis(JITTERBUF *jb, u_long bytes)
+{
+    return (bytes * 8) / jb->jb_bitrate;
+}
+
+/*!
+ * \brief Run the jitter buffer state machine.
+ *
+ * Called by the player thread each time it wakes up. Detects decoder
+ * underruns and (re-)starts the decoder as soon as the high watermark
+ * has been reached or the buffer is full.
+ *
+ * \param jb Jitter buffer controller.
+ */
+void JitterBufUpdate(JITTERBUF *jb)
+{
+    u_long used;
 
     /*
-     * Wait for the lenght byte.
+     * The decoder interrupt stops feeding when running out of data.
      */
-    got = fread(&blks, 1, 1, stream);
-    if(got != 1) {
-        return -1;
+    if (jb->jb_state == JB_PLAYING && VsGetStatus() != VS_STATUS_RUNNING) {
+        jb->jb_underruns++;
+        streamstats.ss_underruns++;
+        jb->jb_state = JB_REBUFFER;
+        jb->jb_rebuf_start = NutGetMillis();
+        VsFadeOut(0);
+        printf("Underrun %lu, rebuffering\n", jb->jb_underruns);
     }
-    if (blks) {
-        if (blks > 32) {
-            printf("Error: Metadata too large, %u blocks\n", blks);
-            return -1;
+
+    if (jb->jb_state != JB_PLAYING) {
+        used = NutSegBufUsed();
+        if (used >= jb->jb_hiwat || NutSegBufAvailable() == 0) {
+            if (jb->jb_state == JB_REBUFFER) {
+                jb->jb_rebuf_ms += NutGetMillis() - jb->jb_rebuf_start;
+            }
+            printf("Kick player, %lu ms buffered\n", JitterBufMillis(jb, used));
+            jb->jb_state = JB_PLAYING;
+            streamstats.ss_kicks++;
+            VsPlayerKick();
+            VsFadeIn(JB_FADE_MS);
         }
+    }
+}
 
-        cnt = blks * 16;
-        if ((mbuf = malloc(cnt + 1)) == 0) {
-            return -1;
+/*!
+ * \brief Calculate how long the player thread may wait.
+ *
+ * While the decoder is playing, this is the time it needs to drain the
+ * buffer down to the low watermark, or down to empty when already below.
+ * Otherwise the player waits for the reader to signal the high
+ * watermark.
+ *
+ * \param jb Jitter buffer controller.
+ *
+ * \return Timeout in milliseconds.
+ */
+u_long JitterBufTimeout(JITTERBUF *jb)
+{
+    u_long used = NutSegBufUsed();
+    u_long ms = JB_MAX_WAIT;
+
+    if (jb->jb_state == JB_PLAYING) {
+        if (used > jb->jb_lowat) {
+            ms = JitterBufMillis(jb, used - jb->jb_lowat);
+        } else {
+            ms = JitterBufMillis(jb, used);
+        }
+        if (ms > JB_MAX_WAIT) {
+            ms = JB_MAX_WAIT;
+        }
+        if (ms < 10) {
+            ms = 10;
         }
+    }
+    return ms;
+}
+
+/*!
+ * \brief Cross-check the decoder's view of the stream with the announced one.
+ *
+ * Samples the decoder status about once a second. The frame sync passes
+ * non-MPEG streams unmodified, in which case the decoder is the only
+ * source of the real bitrate for sizing the jitter buffer.
+ *
+ * \param jb Jitter buffer controller.
+ * \param st Station being played.
+ */
+static void StreamDecoderCheck(JITTERBUF *jb, STATION *st)
+{
+    VSDECODERINFO di;
+
+    if (jb->jb_state != JB_PLAYING || VsDecoderSample() || VsDecoderInfo(&di)) {
+        return;
+    }
+    if (di.di_bitrate == 0 || di.di_bitrate == decoder_kbps || mp3sync.ms_vbr) {
+        return;
+    }
+    decoder_kbps = di.di_bitrate;
+    printf("Decoder %04X, %u kbit/s, %u Hz, %u ch", di.di_format, di.di_bitrate, di.di_samplerate, di.di_channels);
+    if (st->st_info.si_bitrate && st->st_info.si_bitrate != di.di_bitrate) {
+        printf(", %u kbit/s announced", st->st_info.si_bitrate);
+    }
+    putchar('\n');
+    if (mp3sync.ms_state == MP3_SYNC_BYPASS) {
+        JitterBufSetBitrate(jb, di.di_bitrate);
+    }
+}
+
+/*
+ * \brief Read audio data from the stream.
+ *
+ * Nut/OS stdio streams don't buffer input, so after ConnectStation()
+ * fed the header to StreamHdrPut() one fgetc() at a time we may
+ * continue on the socket.
+ *
+ * \return Number of bytes read, 0 on timeout or -1 on error.
+ */
+static int StreamRead(STREAMREADER *rd, u_char *buf, size_t len)
+{
+    if (rd->rd_direct) {
+        return NutTcpReceive(rd->rd_cur.st_sock, buf, (u_short) len);
+    }
+    return fread(buf, 1, len, rd->rd_cur.st_stream);
+}
+
+/*
+ * \brief Receive the next chunk of the stream into the MP3 buffer.
+ *
+ * Data is read directly into the MP3 buffer, behind the bytes held
+ * back by the frame sync. Metadata and junk are stripped in place,
+ * only complete frames are committed. The player is signalled when
+ * the high watermark is crossed.
+ *
+ * \return Number of bytes received, 0 if the buffer is full or -1 if
+ *         the connection has been closed.
+ */
+static int StreamFill(STREAMREADER *rd)
+{
+    JITTERBUF *jb = rd->rd_jb;
+    size_t rbytes;
+    u_char *mp3buf;
+    u_char ief;
+    int got;
+    size_t audio;
+    u_long used;
+    u_long blocks;
 
+    for (;;) {
         /*
-         * Receive the metadata block.
+         * Query number of byte available in MP3 buffer.
          */
-        for (;;) {
-            if ((got = fread(mbuf + rc, 1, cnt, stream)) <= 0) {
+        ief = VsPlayerInterrupts(0);
+        mp3buf = NutSegBufWriteRequest(&rbytes);
+        VsPlayerInterrupts(ief);
+
+        /*
+         * An incomplete frame occupies the whole window. Pass it on to
+         * make room, its remainder will go to the start of the buffer.
+         */
+        if (rbytes == 0 || rbytes > mp3sync.ms_held) {
+            break;
+        }
+        if ((audio = Mp3SyncFlush(&mp3sync)) != 0) {
+            ief = VsPlayerInterrupts(0);
+            NutSegBufWriteCommit(audio);
+            VsPlayerInterrupts(ief);
+        }
+    }
+    if (rbytes == 0) {
+        return 0;
+    }
+
+    if ((got = StreamRead(rd, mp3buf + mp3sync.ms_held, rbytes - mp3sync.ms_held)) <= 0) {
+        return -1;
+    }
+    rd->rd_rx_bytes += got;
+    StreamStatsRx(got);
+    blocks = icymeta.im_blocks;
+    audio = IcyMetaFilter(&icymeta, mp3buf + mp3sync.ms_held, got);
+    streamstats.ss_metablocks += icymeta.im_blocks - blocks;
+    audio = Mp3SyncFilter(&mp3sync, mp3buf, mp3sync.ms_held + audio);
+    if (audio) {
+        ief = VsPlayerInterrupts(0);
+        used = NutSegBufUsed();
+        NutSegBufWriteCommit(audio);
+        VsPlayerInterrupts(ief);
+
+        /* Signal the player when crossing the high watermark. */
+        if (used < jb->jb_hiwat && used + audio >= jb->jb_hiwat) {
+            NutEventPost(&rd->rd_event);
+        }
+    }
+    if (rd->rd_metaseq != icymeta.im_seq) {
+        rd->rd_metaseq = icymeta.im_seq;
+        printf("\nMeta='%s'\n", icymeta.im_title);
+    }
+    if (mp3sync.ms_changed) {
+        mp3sync.ms_changed = 0;
+        Mp3SyncReport(&mp3sync);
+        JitterBufSetBitrate(jb, mp3sync.ms_vbr ? mp3sync.ms_brmax : mp3sync.ms_info.fi_bitrate);
+    }
+    return got;
+}
+
+/*
+ * \brief Switch the reader to the standby station.
+ *
+ * Only complete frames are committed to the MP3 buffer, so dropping the
+ * incomplete frame held back from the old station cuts it at a frame
+ * boundary. The audio of the old station already queued keeps playing
+ * and the frames of the new one are appended by the next StreamFill().
+ * Thus the decoder is neither stopped nor reloaded.
+ *
+ * On return rd_next contains the old connection, to be closed by the
+ * thread which requested the switch.
+ */
+static void StreamSwap(STREAMREADER *rd)
+{
+    STATION old = rd->rd_cur;
+
+    rd->rd_cur = rd->rd_next;
+    rd->rd_next = old;
+    rd->rd_switch = 0;
+
+    IcyMetaInit(&icymeta, rd->rd_cur.st_info.si_metaint);
+    rd->rd_metaseq = icymeta.im_seq;
+    Mp3SyncInit(&mp3sync);
+    JitterBufSetBitrate(rd->rd_jb, rd->rd_cur.st_info.si_bitrate);
+
+    printf("Switched, %lu bytes of the old station queued\n", NutSegBufUsed());
+    NutEventPost(&rd->rd_swapped);
+}
+
+/*
+ * \brief Start a new receive rate measurement window.
+ */
+static void StreamRateReset(STREAMREADER *rd)
+{
+    rd->rd_rx_bytes = 0;
+    rd->rd_rx_start = NutGetMillis();
+    rd->rd_underruns = rd->rd_jb->jb_underruns;
+}
+
+/*
+ * \brief Check the health of the running stream.
+ *
+ * A stream is considered stalled, if it is received below the bitrate
+ * for SUP_STALL_WINDOWS windows or if the decoder ran out of data
+ * SUP_MAX_UNDERRUNS times within one window. VBR streams are checked
+ * against the average bitrate of their frames, not the peak one the
+ * buffer is sized for.
+ *
+ * \return 0 if the stream is healthy, -1 if it stalled.
+ */
+static int StreamCheck(STREAMREADER *rd)
+{
+    JITTERBUF *jb = rd->rd_jb;
+    u_long elapsed = NutGetMillis() - rd->rd_rx_start;
+    u_long kbps;
+    u_short bitrate = jb->jb_bitrate;
+
+    if (elapsed < SUP_WINDOW_MS) {
+        return 0;
+    }
+
+    if (jb->jb_underruns - rd->rd_underruns >= SUP_MAX_UNDERRUNS) {
+        health.hl_starved++;
+        printf("Decoder starving\n");
+        return -1;
+    }
+
+    /* One kbit/s equals one bit per millisecond. */
+    kbps = (rd->rd_rx_bytes * 8) / elapsed;
+    if (mp3sync.ms_vbr) {
+        bitrate = mp3sync.ms_bravg >> MP3_BRAVG_SHIFT;
+    }
+    if (kbps * 100 < (u_long) bitrate * SUP_MIN_RATE) {
+        if (++rd->rd_stalls >= SUP_STALL_WINDOWS) {
+            health.hl_stalls++;
+            printf("Stalled at %lu kbit/s\n", kbps);
+            return -1;
+        }
+    } else {
+        rd->rd_stalls = 0;
+    }
+    StreamRateReset(rd);
+
+    return 0;
+}
+
+/*
+ * \brief Reconnect after the stream failed.
+ *
+ * The failed connection is closed and the candidates of the current
+ * station are tried with jittered exponential backoff. The decoder
+ * keeps playing the buffered audio meanwhile. A station switch
+ * requested during recovery ends it.
+ *
+ * \return 0 if the stream has been recovered, -1 if we gave up.
+ */
+static int StreamRecover(STREAMREADER *rd)
+{
+    STATION st;
+    u_long t0 = NutGetMillis();
+    u_long delay = SUP_BACKOFF_MIN;
+    u_long ms;
+    u_short tries = 0;
+
+    StationClose(&rd->rd_cur);
+
+    for (;;) {
+        ms = delay / 2 + (u_long) rand() % (delay / 2 + 1);
+        printf("Reconnect in %lu ms\n", ms);
+        NutEventWait(&rd->rd_room, ms);
+
+        if (rd->rd_switch) {
+            break;
+        }
+        if (rd->rd_standby == 0) {
+            if (StationReopen(&st) == 0) {
+                rd->rd_cur = st;
+                IcyMetaInit(&icymeta, st.st_info.si_metaint);
+                rd->rd_metaseq = icymeta.im_seq;
+                Mp3SyncRestart(&mp3sync);
+                JitterBufSetBitrate(rd->rd_jb, st.st_info.si_bitrate);
+                health.hl_reconnects++;
+                streamstats.ss_reconnects++;
+                break;
+            }
+            health.hl_failures++;
+            if (SUP_MAX_RETRIES && ++tries >= SUP_MAX_RETRIES) {
                 return -1;
             }
-            if ((cnt -= got) == 0) {
-                break;
+            if ((delay *= 2) > SUP_BACKOFF_MAX) {
+                delay = SUP_BACKOFF_MAX;
             }
-            rc += got;
-            mbuf[rc] = 0;
         }
+    }
 
-        printf("\nMeta='%s'\n", mbuf);
-        free(mbuf);
+    ms = NutGetMillis() - t0;
+    health.hl_recover_ms = ms;
+    health.hl_recover_total += ms;
+    if (ms > health.hl_recover_max) {
+        health.hl_recover_max = ms;
     }
+    printf("Recovered in %lu ms\n", ms);
+
+    rd->rd_stalls = 0;
+    StreamRateReset(rd);
+
     return 0;
 }
 
+/*
+ * \brief Stream reader thread.
+ *
+ * Receives the stream and supervises its health. Connections which
+ * fail or stall are replaced. When the buffer is full, the thread
+ * waits until the player posts rd_room. A pending station switch is
+ * always completed before the thread terminates.
+ */
+THREAD(StreamReader, arg)
+{
+    STREAMREADER *rd = (STREAMREADER *) arg;
+    int got;
+
+    StreamRateReset(rd);
+    for (;;) {
+        if (rd->rd_switch) {
+            StreamSwap(rd);
+            StreamRateReset(rd);
+            continue;
+        }
+
+        got = StreamFill(rd);
+        if (got < 0) {
+            health.hl_errors++;
+            printf("Connection lost\n");
+        }
+        if (got < 0 || StreamCheck(rd)) {
+            if (rd->rd_switch) {
+                continue;
+            }
+            if (StreamRecover(rd)) {
+                break;
+            }
+            continue;
+        }
+
+        /*
+         * Buffer is full. Let the player start the decoder and wait
+         * until it drained the buffer. This doesn't count as a stall.
+         */
+        if (got == 0) {
+            rd->rd_waiting = 1;
+            NutEventPost(&rd->rd_event);
+            NutEventWait(&rd->rd_room, JB_MAX_WAIT);
+            rd->rd_waiting = 0;
+            StreamRateReset(rd);
+            continue;
+        }
+        NutThreadYield();
+    }
+
+    rd->rd_eof = 1;
+    NutEventPost(&rd->rd_event);
+    NutThreadExit();
+    for (;;);
+}
+
+/*!
+ * \brief Get the stream health counters.
+ */
+CONST STREAMHEALTH *StreamHealth(void)
+{
+    return &health;
+}
+
+/*!
+ * \brief Switch the playing stream to another station.
+ *
+ * Make-before-break: the new station is connected and pre-buffered
+ * in its TCP receive window while the old one keeps playing. Then the
+ * reader switches over and the old connection is closed.
+ *
+ * Must be called from a thread other than the player. While a switch
+ * is in progress, PlayMp3Stream() doesn't return, which keeps the
+ * reader context valid.
+ *
+ * Nothing in this application calls it yet, it is provided for the
+ * user interface.
+ *
+ * The new station is resolved into a URL table of its own. It replaces
+ * the one of the old station after the reader switched over, so a
+ * failed switch leaves the reader reconnecting to the old station.
+ *
+ * \param url URL of the new station.
+ *
+ * \return 0 on success, -1 if nothing is playing or the new station
+ *         can't be connected.
+ */
+int StationSwitch(CONST char *url)
+{
+    static PLAYLIST pl;
+    STREAMREADER *rd = reader;
+    STATION st;
+    u_long need;
+    u_long t0;
+    int rc = -1;
+
+    if (rd == 0 || rd->rd_eof || rd->rd_standby) {
+        return -1;
+    }
+
+    /*
+     * Keep the reader from reconnecting the old station and the player
+     * from returning meanwhile.
+     */
+    rd->rd_standby = 1;
+    PlaylistInit(&pl);
+    if (PlaylistAdd(&pl, url) == 0 && StationConnectNext(&st, &pl) == 0) {
+        /*
+         * Let the new connection pre-buffer up to the high watermark,
+         * as far as its receive window allows.
+         */
+        need = ((u_long) JB_HIWAT_MS * (st.st_info.si_bitrate ? st.st_info.si_bitrate : JB_DEFAULT_BITRATE)) / 8;
+        if (need > (mp3_bufsiz / 4) * 3) {
+            need = (mp3_bufsiz / 4) * 3;
+        }
+        if (need > tcp_rcvbuf - tcp_rcvbuf / 8) {
+            need = tcp_rcvbuf - tcp_rcvbuf / 8;
+        }
+        t0 = NutGetMillis();
+        while (StationBuffered(&st) < need && NutGetMillis() - t0 < SWITCH_PREBUF_TIMEOUT && !rd->rd_eof) {
+            NutSleep(50);
+        }
+
+        if (rd->rd_eof) {
+            /* The reader terminated while we were connecting. */
+            StationClose(&st);
+        } else {
+            /*
+             * Hand the new connection over to the reader and wait until
+             * it returns the old one.
+             */
+            rd->rd_next = st;
+            rd->rd_switch = 1;
+            NutEventPost(&rd->rd_room);
+            NutEventWait(&rd->rd_swapped, NUT_WAIT_INFINITE);
+            StationClose(&rd->rd_next);
+            memcpy(&playlist, &pl, sizeof(PLAYLIST));
+            rc = 0;
+        }
+    }
+
+    /* Let the player return. */
+    rd->rd_standby = 0;
+    NutEventPost(&rd->rd_event);
+
+    return rc;
+}
+
+/*
+ * \brief Allocate the MP3 buffer and size the TCP window.
+ *
+ * The buffer should hold MP3_BUFFER_MS of audio at the given bitrate.
+ * With banked memory, the NutSegBuf routines use all banks and the
+ * heap is left to the TCP window. Otherwise buffer and window share
+ * the heap, leaving MP3_HEAP_RESERVE bytes to other threads.
+ *
+ * \param sock    Socket of the running connection.
+ * \param bitrate Stream bitrate in kbit/s, 0 if unknown.
+ *
+ * \return Size of the buffer or 0 if out of memory.
+ */
+static u_long StreamBufferInit(TCPSOCKET *sock, u_short bitrate)
+{
+    u_long budget = NutHeapAvailable();
+    u_long size;
+    u_long win;
+
+    budget = budget > MP3_HEAP_RESERVE ? budget - MP3_HEAP_RESERVE : 0;
+
+#if NUTBANK_COUNT
+    if (NutSegBufInit(0) == 0) {
+        return 0;
+    }
+    size = NutSegBufAvailable() + NutSegBufUsed();
+    win = budget;
+#else
+    size = ((u_long) MP3_BUFFER_MS * (bitrate ? bitrate : JB_DEFAULT_BITRATE)) / 8;
+    if (size + TCPIP_MIN_RCVBUF > budget) {
+        size = budget > TCPIP_MIN_RCVBUF ? budget - TCPIP_MIN_RCVBUF : 0;
+    }
+    if (size < MP3_MIN_BUFSIZ) {
+        size = MP3_MIN_BUFSIZ;
+    }
+    if (NutSegBufInit((size_t) size) == 0) {
+        return 0;
+    }
+    win = budget > size ? budget - size : 0;
+#endif
+
+    /*
+     * Don't let the TCP window hold what the MP3 buffer holds anyway.
+     * Sockets created later on use the same window.
+     */
+    if (win > TCPIP_MAX_RCVBUF) {
+        win = TCPIP_MAX_RCVBUF;
+    }
+    if (win < TCPIP_MIN_RCVBUF) {
+        win = TCPIP_MIN_RCVBUF;
+    }
+    tcp_rcvbuf = (u_short) win;
+    NutTcpSetSockOpt(sock, SO_RCVBUF, &tcp_rcvbuf, sizeof(tcp_rcvbuf));
+
+    printf("MP3 buffer %lu bytes, TCP window %u bytes\n", size, tcp_rcvbuf);
+
+    return size;
+}
+
 /*
  * \brief Play MP3 stream.
  *
- * \param stream Socket stream to read MP3 data from.
+ * Starts a reader thread and controls the decoder until the stream
+ * is closed and the buffer has been played.
+ *
+ * \param st Connected station. Updated when StationSwitch() switched
+ *           to another station, the caller closes the connection.
  */
-void PlayMp3Stream(FILE *stream, u_long metaint)
+void PlayMp3Stream(STATION *st)
 {
-    size_t rbytes;
-    u_char *mp3buf;
     u_char ief;
-    int got = 0;
-    u_long last;
-    u_long mp3left = metaint;
+    JITTERBUF jb;
+    STREAMREADER rd;
 
     /*
      * Initialize the MP3 buffer. The NutSegBuf routines provide a global
      * system buffer, which works with banked and non-banked systems.
      */
-    if (NutSegBufInit(8192) == 0) {
+    if ((mp3_bufsiz = StreamBufferInit(st->st_sock, st->st_info.si_bitrate)) == 0) {
         puts("Error: MP3 buffer init failed");
         return;
     }
@@ -395,6 +1325,7 @@ void PlayMp3Stream(FILE *stream, u_long metaint)
         return;
     }
     VsSetVolume(0, 0);
+    VsFadeOut(0);
 
     /* 
      * Reset the MP3 buffer. 
@@ -402,79 +1333,69 @@ void PlayMp3Stream(FILE *stream, u_long metaint)
     ief = VsPlayerInterrupts(0);
     NutSegBufReset();
     VsPlayerInterrupts(ief);
-    last = NutGetSeconds();
-
-    for (;;) {
-        /*
-         * Query number of byte available in MP3 buffer.
-         */
-        ief = VsPlayerInterrupts(0);
-        mp3buf = NutSegBufWriteRequest(&rbytes);
-        VsPlayerInterrupts(ief);
 
-        /*
-         * If the player is not running, kick it.
-         */
-        if (VsGetStatus() != VS_STATUS_RUNNING) {
-            if(rbytes < 1024 || NutGetSeconds() - last > 4UL) {
-                last = NutGetSeconds();
-                puts("Kick player");
-                VsPlayerKick();
-            }
-        }
-
-        /* 
-         * Do not read pass metadata. 
-         */
-        if (metaint && rbytes > mp3left) {
-            rbytes = mp3left;
-        }
-
-        /* 
-         * Read data directly into the MP3 buffer. 
-         */
-        while (rbytes) {
-            if ((got = fread(mp3buf, 1, rbytes, stream)) > 0) {
-                ief = VsPlayerInterrupts(0);
-                mp3buf = NutSegBufWriteCommit(got);
-                VsPlayerInterrupts(ief);
-
-                if (metaint) {
-                    mp3left -= got;
-                    if (mp3left == 0) {
-                        ProcessMetaData(stream);
-                        mp3left = metaint;
-                    }
-                }
+    JitterBufInit(&jb, mp3_bufsiz, st->st_info.si_bitrate, JB_LOWAT_MS, JB_HIWAT_MS);
+    StreamStatsInit();
+    IcyMetaInit(&icymeta, st->st_info.si_metaint);
+    Mp3SyncInit(&mp3sync);
+    decoder_kbps = 0;
+
+    memset(&rd, 0, sizeof(rd));
+    rd.rd_cur = *st;
+    rd.rd_metaseq = icymeta.im_seq;
+    rd.rd_jb = &jb;
+    srand((unsigned int) (confnet.cdn_ip_addr ^ NutGetMillis()));
+#ifdef USE_DIRECT_RECV
+    rd.rd_direct = 1;
+#endif
+    if (NutThreadCreate("reader", StreamReader, &rd, READER_STACK) == 0) {
+        puts("Error: Can't start reader");
+        return;
+    }
+    reader = &rd;
 
-                if(got < rbytes && got < 512) {
-                    printf("%lu buffered\n", NutSegBufUsed());
-                    NutSleep(250);
-                }
-                else {
-                    NutThreadYield();
-                }
-            } else {
+    /*
+     * Sleep until the reader signals a watermark or until the decoder
+     * will have drained the buffer to the low watermark.
+     */
+    for (;;) {
+        if (rd.rd_eof && VsGetStatus() != VS_STATUS_RUNNING) {
+            /*
+             * The stream has ended. Play what is left in the buffer.
+             */
+            if (NutSegBufUsed() == 0) {
                 break;
             }
-            rbytes -= got;
+            jb.jb_state = JB_PLAYING;
+            streamstats.ss_kicks++;
+            VsPlayerKick();
+        } else {
+            JitterBufUpdate(&jb);
         }
 
-        if(got <= 0) {
-            break;
+        StreamStatsLevel(NutSegBufUsed(), mp3_bufsiz);
+        StreamDecoderCheck(&jb, &rd.rd_cur);
+        if (rd.rd_waiting && NutSegBufUsed() <= jb.jb_lowat) {
+            NutEventPost(&rd.rd_room);
         }
+        NutEventWait(&rd.rd_event, JitterBufTimeout(&jb));
+    }
+    reader = 0;
+
+    /* A running StationSwitch() still uses rd. */
+    while (rd.rd_standby) {
+        NutEventWait(&rd.rd_event, NUT_WAIT_INFINITE);
     }
+    *st = rd.rd_cur;
+
+    printf("%lu underruns, %lu ms rebuffering\n", jb.jb_underruns, jb.jb_rebuf_ms);
+    printf("%lu frames, %lu bytes dropped, %lu resyncs\n", mp3sync.ms_frames, mp3sync.ms_dropped, mp3sync.ms_resyncs);
 }
+
 int main(void)
 {
-    TCPSOCKET *sock;
-    FILE *stream;
+    STATION st;
     u_long baud = DBG_BAUDRATE;
-    u_long radio_ip = inet_addr(RADIO_IPADDR);
-    u_short tcpbufsiz = TCPIP_BUFSIZ;
-    u_long rx_to = TCPIP_READTIMEOUT;
-    u_short mss = TCPIP_MSS;
-    u_long metaint;
 
     /*
      * Register UART device and assign stdout to it.
@@ -504,38 +1425,17 @@ int main(void)
         for(;;);
     }
 
-    /*
-     * Create a TCP socket.
-     */
-    if ((sock = NutTcpCreateSocket()) == 0) {
-        puts("Error: Can't create socket");
-        for(;;);
-    }
-
-    /* 
-     * Set socket options. Failures are ignored. 
-     */
-    if (NutTcpSetSockOpt(sock, TCP_MAXSEG, &mss, sizeof(mss)))
-        printf("Sockopt MSS failed\n");
-    if (NutTcpSetSockOpt(sock, SO_RCVTIMEO, &rx_to, sizeof(rx_to)))
-        printf("Sockopt TO failed\n");
-    if (NutTcpSetSockOpt(sock, SO_RCVBUF, &tcpbufsiz, sizeof(tcpbufsiz)))
-        printf("Sockopt rxbuf failed\n");
-
     /*
      * Connect the radio station.
      */
-    radio_ip = inet_addr(RADIO_IPADDR);
-    stream = ConnectStation(sock, radio_ip, RADIO_PORT, &metaint);
+    if (StationOpen(&st, RADIO_URL) == 0) {
 
-    /*
-     * Play the stream.
-     */
-    if(stream) {
-        PlayMp3Stream(stream, metaint);
-        fclose(stream);
+        /*
+         * Play the stream.
+         */
+        PlayMp3Stream(&st);
+        StationClose(&st);
     }
-    NutTcpCloseSocket(sock);
 
     puts("Reset me!");
     for(;;);
@@ -30,6 +30,9 @@
 /*-------------------------------------------------------------------------*/
 /* local defines                                                           */
 /*-------------------------------------------------------------------------*/
+#define LCD_SET_CGRAM       0x40        // CG-RAM address set command
+#define LCD_SET_DDRAM       0x80        // DD-RAM address set command
+#define LCD_CHAR_ROWS       8           // dot rows of a user-defined character
 /*-------------------------------------------------------------------------*/
 /* local variable definitions                                              */
 /*-------------------------------------------------------------------------*/
@@ -218,6 +221,88 @@ static void LcdWaitBusy()
     cbi (LCD_RW_PORT, LCD_RW);              // we are going to write
 }
 
+/*  */
+/*!
+ * \brief Load the bar-graph glyphs into CG-RAM
+ *
+ * User-defined character n (0..7) is a bar of n+1 dot rows, growing
+ * from the bottom of the character cell. Overwrites any other
+ * user-defined characters.
+ */
+/*  */
+void LcdBarInit(void)
+{
+    u_char glyph;
+    u_char row;
+
+    LcdWriteByte(WRITE_COMMAND, LCD_SET_CGRAM);     // CG-RAM address counter to '0'
+
+    for (glyph=0; glyph<LCD_BAR_GLYPHS; ++glyph)
+    {
+        for (row=0; row<LCD_CHAR_ROWS; ++row)
+        {
+            LcdWriteByte(WRITE_DATA, (row >= LCD_CHAR_ROWS-1-glyph) ? 0x1F : 0x00);
+        }
+    }
+
+    LcdWriteByte(WRITE_COMMAND, LCD_SET_DDRAM);     // back to DD-RAM, cursor pos '0'
+}
+
+/*  */
+/*!
+ * \brief Draw a bar graph across both lines of the LCD
+ *
+ * Each value is drawn as a vertical bar in its own column, two
+ * characters (16 dot rows) high. LcdBarInit() must have been called.
+ *
+ * \param Level values to draw, one per column
+ * \param Count number of values, at most DISPLAY_SIZE
+ * \param Max value that fills a column completely
+ */
+/*  */
+void LcdBarGraph(CONST u_char *Level, u_char Count, u_char Max)
+{
+    u_char i;
+    u_char line;
+    u_char height[DISPLAY_SIZE];
+    u_char rows;
+
+    if (Count > DISPLAY_SIZE)
+    {
+        Count = DISPLAY_SIZE;
+    }
+    if (Max == 0)
+    {
+        Max = 1;
+    }
+
+    for (i=0; i<Count; ++i)
+    {
+        rows = Level[i] > Max ? Max : Level[i];
+        height[i] = (u_char)(((u_short)rows * (NROF_LINES*LCD_CHAR_ROWS) + Max/2) / Max);
+    }
+
+    for (line=0; line<NROF_LINES; ++line)
+    {
+        // line 0 shows the upper half of the bars
+        LcdWriteByte(WRITE_COMMAND, LCD_SET_DDRAM | (line ? FIRSTPOS_LINE_1 : FIRSTPOS_LINE_0));
+
+        for (i=0; i<Count; ++i)
+        {
+            rows = height[i];
+            if (line == 0)
+            {
+                rows = rows > LCD_CHAR_ROWS ? rows - LCD_CHAR_ROWS : 0;
+            }
+            else if (rows > LCD_CHAR_ROWS)
+            {
+                rows = LCD_CHAR_ROWS;
+            }
+            LcdChar(rows ? (char)(rows-1) : ' ');
+        }
+    }
+}
+
 void writeLcd(char text1[], char text2[])
 {
 	int i;
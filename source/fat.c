@@ -1577,6 +1577,11 @@ int FATFileRead(NUTFILE * hNUTFile, void *pData, int nSize)
     int         nSectorCount;
     int         nSectorOffset;
     WORD        wSectorSize;
+    WORD        wRunCount;
+    WORD        wClusterSectors;
+    DWORD       dwRunCluster;
+    DWORD       dwNextCluster;
+    DWORD       dwOffset;
 
     nBytesRead = 0;
 
@@ -1618,6 +1623,66 @@ int FATFileRead(NUTFILE * hNUTFile, void *pData, int nSize)
                 //
                 dwReadSector = dwSector + nSectorCount;
 
+                if ((nSectorOffset == 0) && (nSize >= (int) wSectorSize))
+                {
+                    //
+                    // Whole sectors go straight to the caller, as one run
+                    // over all clusters that follow each other on the disk
+                    //
+                    wClusterSectors = (WORD)(pDrive->dwClusterSize / wSectorSize);
+                    wRunCount       = wClusterSectors - nSectorCount;
+                    dwRunCluster    = hFile->dwReadCluster;
+
+                    while (((DWORD) wRunCount * wSectorSize) < (DWORD) nSize)
+                    {
+                        dwNextCluster = GetNextCluster(pDrive, dwRunCluster);
+                        if (dwNextCluster != (dwRunCluster + 1))
+                        {
+                            break;
+                        }
+                        dwRunCluster = dwNextCluster;
+                        wRunCount   += wClusterSectors;
+                    }
+                    if (((DWORD) wRunCount * wSectorSize) > (DWORD) nSize)
+                    {
+                        wRunCount = nSize / wSectorSize;
+                    }
+
+                    nError = HWReadSectors(pDrive->bDevice, pByte, dwReadSector, wRunCount);
+                    if (nError != HW_OK)
+                    {
+                        nBytesRead = 0;
+                        hFile->nLastError = FAT_ERROR_IDE;
+                        break;
+                    }
+
+                    nBytesToRead = wRunCount * wSectorSize;
+                    pByte += nBytesToRead;
+                    nSize -= nBytesToRead;
+
+                    hFile->dwFilePointer += nBytesToRead;
+                    if (hFile->dwFilePointer >= hFile->dwFileSize)
+                    {
+                        hFile->nEOF = TRUE;
+                    }
+
+                    //
+                    // The run is contiguous, so the cluster it ends in is
+                    // found by counting. An end at a cluster boundary stays
+                    // in that cluster, the next one is looked up below
+                    //
+                    dwOffset = hFile->dwClusterPointer + nBytesToRead;
+                    hFile->dwReadCluster   += (dwOffset - 1) / pDrive->dwClusterSize;
+                    hFile->dwClusterPointer = dwOffset - (((dwOffset - 1) / pDrive->dwClusterSize) * pDrive->dwClusterSize);
+
+                    if (hFile->dwClusterPointer >= pDrive->dwClusterSize)
+                    {
+                        hFile->dwReadCluster = GetNextCluster(pDrive, hFile->dwReadCluster);
+                        hFile->dwClusterPointer = 0;
+                    }
+                    continue;
+                }
+
                 nError = HWReadSectors(pDrive->bDevice, pSectorBuffer, dwReadSector, 1);
                 if (nError == HW_OK)
                 {
@@ -55,14 +55,6 @@
 #define DFCMD_BUF1_WRITE        0x84    /* Buffer 1 write. */
 #define DFCMD_BUF1_FLASH        0x83    /* Buffer 1 flash with page erase. */
 
-/*
- *  \brief last page of flash (264 bytes) can be dedicated for parameter storage
- *   Special routines are provided for that goal but can be disabled here to save
- *   codespace (about 360 bytes of code for GCC)
- */
-
-//#define USE_FLASH_PARAM_PAGE
-
 /*-------------------------------------------------------------------------*/
 /* typedefs & structs                                                      */
 /*-------------------------------------------------------------------------*/
@@ -135,32 +127,20 @@ static int At45dbTransfer(CONST void *txbuf, void *rxbuf, int xlen, CONST void *
  */
 //                                        cb,          cb,        len,             tdata,         rdata,      datalen
 static int At45dbTransfer(CONST void *txbuf, void *rxbuf, int xlen, CONST void *txnbuf, void *rxnbuf, int xnlen)
-{   int i;
-    u_char *ptTxbuf, *ptRxbuf;
-
-    SPIselect(SPI_DEV_FLASH);
+{
+    SPIbegin(SPI_DEV_FLASH);
 
-    ptTxbuf=(u_char*)txbuf;
-    ptRxbuf=(u_char*)rxbuf;
     /*
      *  send command, store the bytes that were read the same time
      */
-    for (i=0; i<xlen; ++i)
-    {
-        *ptRxbuf++=SPItransferByte(*ptTxbuf++);
-    }
+    SPIexchangeBlock((CONST u_char*)txbuf, (u_char*)rxbuf, xlen);
 
-    ptTxbuf=(u_char*)txnbuf;
-    ptRxbuf=(u_char*)rxnbuf;
     /*
      *  send dummy data, store the bytes that were read the same time
      */
-    for (i=0; i<xnlen; ++i)
-    {
-        *ptRxbuf++=SPItransferByte(*ptTxbuf++);
-    }
+    SPIexchangeBlock((CONST u_char*)txnbuf, (u_char*)rxnbuf, xnlen);
 
-    SPIdeselect();
+    SPIend();
 
     return(0);  // always...
 
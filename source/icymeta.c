@@ -0,0 +1,273 @@
+/* ========================================================================
+ * [PROJECT]    SIR
+ * [MODULE]     IcyMeta
+ * [TITLE]      ICY metadata demultiplexer
+ * [FILE]       icymeta.c
+ * [VSN]        1.0
+ * [CREATED]    17102026
+ * [LASTCHNGD]  17102026
+ * [COPYRIGHT]  Copyright (C) STREAMIT BV 2010
+ * [PURPOSE]    splits a Shoutcast/Icecast stream into audio and metadata
+ *              while it sits in the receive buffer. Metadata is removed
+ *              in place and StreamTitle/StreamUrl are parsed into fixed
+ *              slots, so nothing is allocated on the heap.
+ * ======================================================================== */
+
+/*-------------------------------------------------------------------------*/
+/* includes                                                                */
+/*-------------------------------------------------------------------------*/
+#include <string.h>
+
+#include "icymeta.h"
+
+/*-------------------------------------------------------------------------*/
+/* local defines                                                           */
+/*-------------------------------------------------------------------------*/
+/*
+ *  demultiplexer states
+ */
+#define ICY_STATE_AUDIO     0       /* passing audio bytes */
+#define ICY_STATE_LENGTH    1       /* waiting for the length byte */
+#define ICY_STATE_DATA      2       /* consuming a metadata block */
+
+/*
+ *  parser states, metadata looks like: StreamTitle='...';StreamUrl='...';
+ */
+#define ICY_PARSE_KEY       0       /* collecting key up to '=' */
+#define ICY_PARSE_OPEN      1       /* expecting opening quote */
+#define ICY_PARSE_VALUE     2       /* collecting value */
+#define ICY_PARSE_QUOTE     3       /* got a quote, value ends if ';' follows */
+
+/*-------------------------------------------------------------------------*/
+/* local routines (prototyping)                                            */
+/*-------------------------------------------------------------------------*/
+static void IcyMetaPublish(ICYMETA *im);
+static void IcyMetaAddValue(ICYMETA *im, char ch);
+static void IcyMetaParse(ICYMETA *im, CONST u_char *cp, size_t len);
+
+/*!
+ * \addtogroup IcyMeta
+ */
+
+/*@{*/
+
+/*-------------------------------------------------------------------------*/
+/*                         start of code                                   */
+/*-------------------------------------------------------------------------*/
+
+/*!
+ * \brief copy a completed value into its slot
+ *
+ * Values of unknown keys are dropped.
+ */
+static void IcyMetaPublish(ICYMETA *im)
+{
+    im->im_value[im->im_vallen] = 0;
+
+    if (strcmp(im->im_key, "StreamTitle") == 0)
+    {
+        strcpy(im->im_title, im->im_value);
+        im->im_seq++;
+    }
+    else if (strcmp(im->im_key, "StreamUrl") == 0)
+    {
+        strncpy(im->im_url, im->im_value, ICY_URL_SIZE - 1);
+        im->im_url[ICY_URL_SIZE - 1] = 0;
+    }
+    im->im_keylen = 0;
+    im->im_vallen = 0;
+    im->im_pstate = ICY_PARSE_KEY;
+}
+
+/*!
+ * \brief append a character to the current value, silently truncating
+ */
+static void IcyMetaAddValue(ICYMETA *im, char ch)
+{
+    if (im->im_vallen < ICY_TITLE_SIZE - 1)
+    {
+        im->im_value[im->im_vallen++] = ch;
+    }
+}
+
+/*!
+ * \brief feed a piece of a metadata block into the key/value parser
+ *
+ * Blocks may be split at any byte, so the parser keeps its state in
+ * the ICYMETA structure. Quotes inside values are accepted, a value
+ * only ends at a quote followed by a semicolon.
+ */
+static void IcyMetaParse(ICYMETA *im, CONST u_char *cp, size_t len)
+{
+    char ch;
+
+    while (len--)
+    {
+        ch = (char) *cp++;
+
+        switch (im->im_pstate)
+        {
+            case ICY_PARSE_KEY:
+                if (ch == '=')
+                {
+                    im->im_key[im->im_keylen] = 0;
+                    im->im_pstate = ICY_PARSE_OPEN;
+                }
+                else if (ch && im->im_keylen < ICY_KEY_SIZE - 1)
+                {
+                    im->im_key[im->im_keylen++] = ch;
+                }
+                break;
+
+            case ICY_PARSE_OPEN:
+                if (ch == '\'')
+                {
+                    im->im_vallen = 0;
+                    im->im_pstate = ICY_PARSE_VALUE;
+                }
+                break;
+
+            case ICY_PARSE_VALUE:
+                if (ch == '\'')
+                {
+                    im->im_pstate = ICY_PARSE_QUOTE;
+                }
+                else if (ch)
+                {
+                    IcyMetaAddValue(im, ch);
+                }
+                break;
+
+            case ICY_PARSE_QUOTE:
+                if (ch == ';' || ch == 0)
+                {
+                    IcyMetaPublish(im);
+                }
+                else
+                {
+                    /* quote was part of the value */
+                    IcyMetaAddValue(im, '\'');
+                    if (ch == '\'')
+                    {
+                        break;
+                    }
+                    IcyMetaAddValue(im, ch);
+                    im->im_pstate = ICY_PARSE_VALUE;
+                }
+                break;
+        }
+    }
+}
+
+/*!
+ * \brief initialise the demultiplexer for a new stream
+ *
+ * \param im      demultiplexer state
+ * \param metaint value of the icy-metaint header, 0 if the stream
+ *                carries no metadata
+ */
+void IcyMetaInit(ICYMETA *im, u_long metaint)
+{
+    memset(im, 0, sizeof(ICYMETA));
+    im->im_metaint = metaint;
+    im->im_audioleft = metaint;
+    im->im_state = ICY_STATE_AUDIO;
+    im->im_pstate = ICY_PARSE_KEY;
+}
+
+/*!
+ * \brief remove metadata from a block of received stream data
+ *
+ * The block is processed in place. Audio bytes are moved to the front
+ * of the buffer, metadata is handed to the parser. The caller should
+ * commit only the returned number of bytes to the MP3 buffer.
+ *
+ * \param im  demultiplexer state
+ * \param buf received data
+ * \param len number of bytes in buf
+ *
+ * \return number of audio bytes left at the start of buf
+ */
+size_t IcyMetaFilter(ICYMETA *im, u_char *buf, size_t len)
+{
+    u_char *src = buf;
+    u_char *dst = buf;
+    size_t n;
+
+    if (im->im_metaint == 0)
+    {
+        return(len);
+    }
+
+    while (len)
+    {
+        switch (im->im_state)
+        {
+            case ICY_STATE_AUDIO:
+                n = len;
+                if (n > im->im_audioleft)
+                {
+                    n = (size_t) im->im_audioleft;
+                }
+                /* only audio following a metadata block needs to be moved */
+                if (dst != src)
+                {
+                    memmove(dst, src, n);
+                }
+                dst += n;
+                src += n;
+                len -= n;
+                im->im_audioleft -= n;
+                if (im->im_audioleft == 0)
+                {
+                    im->im_state = ICY_STATE_LENGTH;
+                }
+                break;
+
+            case ICY_STATE_LENGTH:
+                im->im_metaleft = (u_short) *src++ * 16;
+                len--;
+                if (im->im_metaleft)
+                {
+                    im->im_keylen = 0;
+                    im->im_vallen = 0;
+                    im->im_pstate = ICY_PARSE_KEY;
+                    im->im_state = ICY_STATE_DATA;
+                }
+                else
+                {
+                    im->im_audioleft = im->im_metaint;
+                    im->im_state = ICY_STATE_AUDIO;
+                }
+                break;
+
+            case ICY_STATE_DATA:
+                n = len;
+                if (n > im->im_metaleft)
+                {
+                    n = im->im_metaleft;
+                }
+                IcyMetaParse(im, src, n);
+                src += n;
+                len -= n;
+                im->im_metaleft -= n;
+                if (im->im_metaleft == 0)
+                {
+                    /* accept a last value without the closing ';' */
+                    if (im->im_pstate == ICY_PARSE_VALUE || im->im_pstate == ICY_PARSE_QUOTE)
+                    {
+                        IcyMetaPublish(im);
+                    }
+                    im->im_blocks++;
+                    im->im_audioleft = im->im_metaint;
+                    im->im_state = ICY_STATE_AUDIO;
+                }
+                break;
+        }
+    }
+    return(dst - buf);
+}
+
+/* ---------- end of module ------------------------------------------------ */
+
+/*@}*/
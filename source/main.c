@@ -106,6 +106,8 @@
 #include "flash.h"
 #include "rtc.h"
 #include "spidrv.h"
+#include "streamstats.h"
+#include "tonectrl.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -635,6 +637,32 @@ static int ShowSockets(FILE * stream, REQUEST * req)
     return 0;
 }
 
+#ifdef USE_STREAM_PLAYER
+/*
+ * CGI: Show playback statistics.
+ *
+ * The counters are kept by the stream player (PlayStream.c), so this
+ * is only built where the player is linked in.
+ *
+ * This routine must have been registered by NutRegisterCgi() and is
+ * automatically called by NutHttpProcessRequest() when the client
+ * request the URL 'cgi-bin/stream.cgi'. Returns a JSON object, or
+ * 'name=value' lines when requested as 'cgi-bin/stream.cgi?text'.
+ */
+static int ShowStream(FILE * stream, REQUEST * req)
+{
+    u_char json = req->req_query == 0 || strcmp(req->req_query, "text") != 0;
+
+    NutHttpSendHeaderTop(stream, req, 200, "Ok");
+    NutHttpSendHeaderBottom(stream, req, json ? "application/json" : "text/plain", -1);
+
+    StreamStatsPrint(stream, json);
+    fflush(stream);
+
+    return 0;
+}
+#endif /* USE_STREAM_PLAYER */
+
 #ifdef USE_CGI_PARAMETERS
 /*
  * CGI Sample: Proccessing a form.
@@ -1069,6 +1097,9 @@ printf("Mounting block device ");
     NutRegisterCgi("threads.cgi", ShowThreads);
     NutRegisterCgi("timers.cgi", ShowTimers);
     NutRegisterCgi("sockets.cgi", ShowSockets);
+#ifdef USE_STREAM_PLAYER
+    NutRegisterCgi("stream.cgi", ShowStream);
+#endif
 
 #ifdef USE_CGI_PARAMETERS
     /*
@@ -1132,8 +1163,13 @@ rtc_init()
 
         if (At45dbInit()==AT45DB041B)
         {
+                ToneCtrlInit();
         }
 
+#ifdef SPI_BENCHMARK
+        SPIbenchmark();
+#endif
+
 
         RcInit();
         KbInit();
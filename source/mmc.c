@@ -181,19 +181,16 @@ int CardInitCard()
     int fid;        // current file descriptor
     char szFileName[10];
     //u_char i;
-	u_char ief;
 
     /*
      * Register our device for the file system (if not done already.....)
      */
     if (NutDeviceLookup(devFAT.dev_name) == 0)
     {
-        ief = VsPlayerInterrupts(0);
         if ((iResult=NutRegisterDevice(&devFAT, FAT_MODE_MMC, 0)) == 0)
         {
             iResult=NutRegisterDevice(&devFATMMC0, FAT_MODE_MMC, 0);
         }
-        VsPlayerInterrupts(ief);
     }
     else
     {
@@ -204,7 +201,6 @@ int CardInitCard()
          */
 
         FATRelease();
-        ief = VsPlayerInterrupts(0);
         dev=&devFAT;
         if (dev->dev_init == 0 || (*dev->dev_init)(dev) == 0)
         {
@@ -214,7 +210,6 @@ int CardInitCard()
                 iResult=0;
             }
         }
-        VsPlayerInterrupts(ief);
     }
 
     if (iResult==0)
@@ -48,6 +48,7 @@
 #include <sys/thread.h>
 #include <sys/event.h>
 #include <sys/heap.h>
+#include <sys/atom.h>
 
 #include "typedefs.h"
 #include "portio.h"
@@ -62,6 +63,12 @@
 /*==========================================================*/
 #define MMC_MAX_SUPPORTED_DEVICE    1
 
+/*
+ * Sectors moved with one multiple block command. The bus is released
+ * between the blocks of a run as well, see MMCRunPause().
+ */
+#define MMC_MAX_RUN                 8
+
 /*
  * Drive Flags
  */
@@ -91,6 +98,51 @@
 #define MMC_INIT          1
 #define MMC_READ_CSD    9
 #define MMC_READ_CID    10
+#define MMC_STOP_TRANSMISSION       12
+#define MMC_READ_MULTIPLE_BLOCK     18
+#define MMC_SET_WR_BLK_ERASE_COUNT  23  /* ACMD23, SD only */
+#define MMC_WRITE_MULTIPLE_BLOCK    25
+#define MMC_APP_CMD                 55
+
+#define MMC_TOKEN_MULTI_WRITE   0xfc
+#define MMC_TOKEN_STOP_TRAN     0xfd
+
+#define MMC_R1_ILLEGAL_CMD      0x04
+#define MMC_R1_INVALID          0x80    /* always clear in a valid R1 */
+
+#if (MMC_TRANSPORT == MMC_TRANSPORT_USART)
+/*
+ * USART1 in master SPI mode. The card has the data lines for itself, but
+ * its chip select is shared with spidrv: SPIselect() of any other device
+ * deselects the card. Hence MMCBegin() takes the spidrv bus lock, which
+ * keeps other threads and the decoder feed off the select lines until
+ * MMCEnd(). The SPI unit is set up for the card by SPIbegin(), but not
+ * clocked. With a select line of its own, MMCBegin()/MMCEnd() may drive
+ * MMC_CS_PORT/MMC_CS_BIT directly instead.
+ */
+#define MMC_USART_UBRR    0           /* fosc/2 */
+#define MMC_USART_DDR     DDRD
+#define MMC_USART_XCK     5           /* XCK1 */
+#define MMC_USART_TXD     3           /* TXD1 */
+#define MMC_CS_PORT       MMCVS_OUT_WRITE
+#define MMC_CS_BIT        MMC_ENABLE
+
+#define MMCBegin()          SPIbegin(SPI_DEV_MMC)
+#define MMCEnd()            SPIend()
+#define MMCPutByte(b)       ((void)MMCUsartTransfer(b))
+#define MMCGetByte()        MMCUsartTransfer(0xff)
+#define MMCReadBytes(p, n)  MMCUsartReadBlock((p), (n))
+#define MMCReadBlock(p)     MMCUsartReadBlock((p), MMC_SECTOR_SIZE)
+#define MMCWriteBlock(p)    MMCUsartWriteBlock(p)
+#else
+#define MMCBegin()          SPIbegin(SPI_DEV_MMC)
+#define MMCEnd()            SPIend()
+#define MMCPutByte(b)       SPIputByte(b)
+#define MMCGetByte()        SPIgetByte()
+#define MMCReadBytes(p, n)  SPIreadBlock((p), (n))
+#define MMCReadBlock(p)     SPIreadBlock((p), MMC_SECTOR_SIZE)
+#define MMCWriteBlock(p)    SPIwriteBlock((p), MMC_SECTOR_SIZE)
+#endif
 
 typedef struct _drive
 {
@@ -145,6 +197,90 @@ static void MMCSemaInit(void)
     NutEventPost(&hMMCSemaphore);
 } /* MMCSemaInit */
 
+#if (MMC_TRANSPORT == MMC_TRANSPORT_USART)
+/************************************************************/
+/*  MMCUsartInit                                            */
+/*                                                          */
+/* - switches USART1 to master SPI mode, SPI mode 0, MSB    */
+/*   first. Baudrate must be 0 while enabling the unit      */
+/************************************************************/
+static void MMCUsartInit(void)
+{
+    UBRR1 = 0;
+    sbi(MMC_USART_DDR, MMC_USART_XCK);
+    sbi(MMC_USART_DDR, MMC_USART_TXD);
+    UCSR1C = (1 << UMSEL11) | (1 << UMSEL10);
+    UCSR1B = (1 << RXEN1) | (1 << TXEN1);
+    UBRR1 = MMC_USART_UBRR;
+} /* MMCUsartInit */
+
+/************************************************************/
+/*  MMCUsartTransfer                                        */
+/*                                                          */
+/* - sends one byte, returns the byte shifted in            */
+/************************************************************/
+static BYTE MMCUsartTransfer(BYTE Byte)
+{
+    while ((UCSR1A & (1 << UDRE1)) == 0);
+    UDR1 = Byte;
+    while ((UCSR1A & (1 << RXC1)) == 0);
+    return(UDR1);
+} /* MMCUsartTransfer */
+
+/************************************************************/
+/*  MMCUsartReadBlock                                       */
+/*                                                          */
+/* - reads wLen (> 0) bytes. The next dummy byte is written */
+/*   while the current one is shifting, so the clock never  */
+/*   stops                                                  */
+/************************************************************/
+static void MMCUsartReadBlock(BYTE *pBuffer, WORD wLen)
+{
+    WORD wCount = wLen - 1;
+
+    UDR1 = 0xff;
+    while (wCount--)
+    {
+        while ((UCSR1A & (1 << UDRE1)) == 0);
+        UDR1 = 0xff;
+        while ((UCSR1A & (1 << RXC1)) == 0);
+        *pBuffer++ = UDR1;
+    }
+    while ((UCSR1A & (1 << RXC1)) == 0);
+    *pBuffer = UDR1;
+} /* MMCUsartReadBlock */
+
+/************************************************************/
+/*  MMCUsartWriteBlock                                      */
+/*                                                          */
+/* - writes one sector with the receiver disabled, keeping  */
+/*   the transmit buffer full. Waits until the last byte    */
+/*   has left the shift register                            */
+/************************************************************/
+static void MMCUsartWriteBlock(CONST BYTE *pBuffer)
+{
+    WORD wCount = MMC_SECTOR_SIZE - 1;
+
+    UCSR1B = (1 << TXEN1);
+    while (wCount--)
+    {
+        while ((UCSR1A & (1 << UDRE1)) == 0);
+        UDR1 = *pBuffer++;
+    }
+    while ((UCSR1A & (1 << UDRE1)) == 0);
+
+    /* TXC may only be set by the last byte */
+    NutEnterCritical();
+    UCSR1A |= (1 << TXC1);
+    UDR1 = *pBuffer;
+    NutExitCritical();
+    while ((UCSR1A & (1 << TXC1)) == 0);
+
+    /* enabling the receiver again starts with an empty buffer */
+    UCSR1B = (1 << RXEN1) | (1 << TXEN1);
+} /* MMCUsartWriteBlock */
+#endif
+
 
 /************************************************************
  * int MMCDataToken(void)
@@ -159,7 +295,7 @@ static BYTE MMCDataToken(void)
 
     while ((Byte != 0xfe) && (--i))
     {
-        Byte = SPIgetByte();
+        Byte = MMCGetByte();
     }
     return(Byte);
 } /* MMCDataToken */
@@ -177,7 +313,7 @@ static BYTE MMCGet(void)
 
     while ((Byte == 0xff) && (--i))
     {
-        Byte = SPIgetByte();
+        Byte = MMCGetByte();
     }
 
     return(Byte);
@@ -191,18 +327,18 @@ static BYTE MMCGet(void)
  ************************************************************/
 static void MMCCommand(unsigned char command, unsigned int px, unsigned int py)
 {
-    SPIselect(SPI_DEV_MMC);
-
-    SPIputByte(0xff);
-    SPIputByte(command | 0x40);
-    SPIputByte((unsigned char)((px >> 8)&0x0ff)); /* high byte of param y */
-    SPIputByte((unsigned char)(px & 0x00ff));     /* low byte of param y */
-    SPIputByte((unsigned char)((py >> 8)&0x0ff)); /* high byte of param x */
-    SPIputByte((unsigned char)(py & 0x00ff));     /* low byte of param x */
-    SPIputByte(0x95);            /* correct CRC for first command in SPI          */
+    MMCBegin();
+
+    MMCPutByte(0xff);
+    MMCPutByte(command | 0x40);
+    MMCPutByte((unsigned char)((px >> 8)&0x0ff)); /* high byte of param y */
+    MMCPutByte((unsigned char)(px & 0x00ff));     /* low byte of param y */
+    MMCPutByte((unsigned char)((py >> 8)&0x0ff)); /* high byte of param x */
+    MMCPutByte((unsigned char)(py & 0x00ff));     /* low byte of param x */
+    MMCPutByte(0x95);            /* correct CRC for first command in SPI          */
                               /* after that CRC is ignored, so no problem with */
                               /* always sending 0x95                           */
-    SPIputByte(0xff);
+    MMCPutByte(0xff);
 } /* MMCCommand */
 
 /************************************************************/
@@ -210,7 +346,6 @@ static void MMCCommand(unsigned char command, unsigned int px, unsigned int py)
 /************************************************************/
 static int GetCSD (DRIVE *pDrive)
 {
-    int   i;
     int  nError = MMC_ERROR;
     BYTE bData[16];
     WORD wREAD_BL_LEN;
@@ -222,19 +357,17 @@ static int GetCSD (DRIVE *pDrive)
     MMCCommand(MMC_READ_CSD, 0, 0);
     if (MMCDataToken() != 0xfe)
     {
+        MMCEnd();
         LogMsg_P(LOG_ERR, PSTR("error during CSD read"));
     }
     else
     {
-        for (i=0; i<16; i++)
-        {
-            bData[i] = SPIgetByte();
-        }
+        MMCReadBytes(bData, 16);
 
-        SPIputByte(0xff);    /* checksum -> don't care about it for now */
-        SPIputByte(0xff);    /* checksum -> don't care about it for now */
+        MMCPutByte(0xff);    /* checksum -> don't care about it for now */
+        MMCPutByte(0xff);    /* checksum -> don't care about it for now */
 
-        SPIdeselect();
+        MMCEnd();
 
         /*
          * Get the READ_BL_LEN
@@ -298,13 +431,13 @@ static void GetCID(void)
 
     for (i=0; i<16; i++)
     {
-        bData[i] = SPIgetByte();
+        bData[i] = MMCGetByte();
     }
 
-    SPIputByte(0xff);    /* checksum -> don't care about it for now */
-    SPIputByte(0xff);    /* checksum -> don't care about it for now */
+    MMCPutByte(0xff);    /* checksum -> don't care about it for now */
+    MMCPutByte(0xff);    /* checksum -> don't care about it for now */
 
-    SPIdeselect();
+    MMCEnd();
 
     printf("MMC: Product Name: %c%c%c%c%c%c\n",
            bData[3], bData[4], bData[5],
@@ -342,7 +475,7 @@ static int InitMMCCard(void)
     PragmaLab: why send dummy bytes with card DEselected? This messes up the VS10XX init */
     for (i = 0; i < 10; i++)
     {
-        SPIputByte(0xff);
+        MMCPutByte(0xff);
     }
 
     /*end PragmaLab */
@@ -352,23 +485,23 @@ static int InitMMCCard(void)
 
     if (MMCGet() != 1)
     {
-        SPIdeselect();
+        MMCEnd();
         return(MMC_ERROR);  // MMC Not detected
     }
 
     /* send CMD1 until we get a 0 back, indicating card is done initializing */
     i = 0xffff;
-    while ((SPIgetByte() != 0) && (--i))
+    while ((MMCGetByte() != 0) && (--i))
     {
         MMCCommand(MMC_INIT, 0, 0);
     }
     if (i == 0)
     {
-        SPIdeselect();
+        MMCEnd();
         return(MMC_ERROR);  // Init Fail
     }
 
-    SPIdeselect();
+    MMCEnd();
     return(MMC_OK);
 } /* InitMMCCard */
 
@@ -379,7 +512,6 @@ static int ReadSectors(DRIVE *pDrive, BYTE *pBuffer, DWORD dStartSector, WORD wS
 {
     int   nError = MMC_OK;
     int   nSector;
-    WORD  wDataCount;
     DWORD dReadSector;
 
     pDrive = pDrive;
@@ -392,25 +524,178 @@ static int ReadSectors(DRIVE *pDrive, BYTE *pBuffer, DWORD dStartSector, WORD wS
         if (MMCDataToken() != 0xfe)
         {
             nError = MMC_ERROR;
-            SPIdeselect();
+            MMCEnd();
             break;
         }
 
-        for (wDataCount=0; wDataCount<512; wDataCount++)
-        { /* read the sector */
-            *pBuffer = SPIgetByte();
-            pBuffer++;
-        }
+        MMCReadBlock(pBuffer);  /* read the sector */
+        pBuffer += 512;
 
-        SPIputByte(0xff);    /* checksum -> don't care about it for now */
-        SPIputByte(0xff);    /* checksum -> don't care about it for now */
-        SPIdeselect();
+        MMCPutByte(0xff);    /* checksum -> don't care about it for now */
+        MMCPutByte(0xff);    /* checksum -> don't care about it for now */
+        MMCEnd();
+
+        /* let the decoder feed and other threads have the bus */
+        NutThreadYield();
     }
 
     return(nError);
 } /* ReadSectors */
 
+/************************************************************/
+/*  MMCWaitReady                                            */
+/*                                                          */
+/* - waits until the card releases the busy signal          */
+/************************************************************/
+static int MMCWaitReady(void)
+{
+    WORD wDataCount = 0xffff;
+
+    while ((MMCGetByte() == 0x00) && (--wDataCount));
+
+    return((wDataCount == 0) ? MMC_ERROR : MMC_OK);
+} /* MMCWaitReady */
+
+/************************************************************/
+/*  MMCRunPause                                             */
+/*                                                          */
+/* - releases the bus between two blocks of a multiple      */
+/*   block transfer, so the decoder feed and other threads  */
+/*   get in. The card keeps the transfer open while it is   */
+/*   deselected                                             */
+/************************************************************/
+static void MMCRunPause(void)
+{
+    MMCEnd();
+    NutThreadYield();
+    MMCBegin();
+} /* MMCRunPause */
+
+/************************************************************/
+/*  ReadMultiSectors                                        */
+/*                                                          */
+/* - reads wSectorCount sectors with one READ_MULTIPLE      */
+/*   command, the card stays selected in between            */
+/* - STOP_TRANSMISSION ends the transfer, also after an     */
+/*   error halfway, unless the card rejected the command    */
+/************************************************************/
+static int ReadMultiSectors(DRIVE *pDrive, BYTE *pBuffer, DWORD dStartSector, WORD wSectorCount)
+{
+    int   nError = MMC_OK;
+
+    pDrive = pDrive;
+
+    MMCCommand(MMC_READ_MULTIPLE_BLOCK, (dStartSector>>7) & 0xffff, (dStartSector<<9) & 0xffff);
+    if (MMCGet() != 0x00)
+    {
+        MMCEnd();
+        return(MMC_ERROR);
+    }
+
+    while (wSectorCount--)
+    {
+        if (MMCDataToken() != 0xfe)
+        {
+            nError = MMC_ERROR;
+            break;
+        }
+
+        MMCReadBlock(pBuffer);
+        pBuffer += MMC_SECTOR_SIZE;
+
+        MMCPutByte(0xff);    /* checksum -> don't care about it for now */
+        MMCPutByte(0xff);    /* checksum -> don't care about it for now */
+
+        if (wSectorCount)
+        {
+            MMCRunPause();
+        }
+    }
+
+    MMCCommand(MMC_STOP_TRANSMISSION, 0, 0);
+    if ((MMCGet() == 0xff) || (MMCWaitReady() != MMC_OK))
+    {
+        nError = MMC_ERROR;
+    }
+
+    MMCEnd();
+
+    return(nError);
+} /* ReadMultiSectors */
+
 #if (MMC_SUPPORT_WRITE == 1)
+/************************************************************/
+/*  WriteMultiSectors                                       */
+/*                                                          */
+/* - tells the card how many sectors follow, so it can      */
+/*   erase them in advance. Only if the card accepted       */
+/*   APP_CMD: MMC cards don't know it, and would take the   */
+/*   next CMD23 as SET_BLOCK_COUNT                          */
+/* - writes wSectorCount sectors with one WRITE_MULTIPLE    */
+/*   command, ended by the stop token                       */
+/************************************************************/
+static BYTE WriteMultiSectors(DRIVE *pDrive, BYTE *pBuffer, DWORD dStartSector, WORD wSectorCount)
+{
+    int   nError = MMC_OK;
+
+    pDrive = pDrive;
+
+    MMCCommand(MMC_APP_CMD, 0, 0);
+    if ((MMCGet() & (MMC_R1_INVALID | MMC_R1_ILLEGAL_CMD)) == 0)
+    {
+        /* only a hint, the write doesn't depend on it */
+        MMCCommand(MMC_SET_WR_BLK_ERASE_COUNT, 0, wSectorCount);
+        MMCGet();
+    }
+
+    MMCCommand(MMC_WRITE_MULTIPLE_BLOCK, (dStartSector>>7) & 0xffff, (dStartSector<<9) & 0xffff);
+    if (MMCGet() != 0x00)
+    {
+        MMCEnd();
+        return(MMC_ERROR);
+    }
+
+    while (wSectorCount--)
+    {
+        MMCPutByte(0xff);
+        MMCPutByte(MMC_TOKEN_MULTI_WRITE);
+
+        MMCWriteBlock(pBuffer);
+        pBuffer += MMC_SECTOR_SIZE;
+
+        MMCPutByte(0xff);  /* checksum -> don't care about it for now */
+        MMCPutByte(0xff);  /* checksum -> don't care about it for now */
+
+        /* data response xxx0sss1, sss = 010: accepted */
+        if ((MMCGetByte() & 0x1f) != 0x05)
+        {
+            nError = MMC_ERROR;
+            break;
+        }
+        if (MMCWaitReady() != MMC_OK)
+        {
+            nError = MMC_ERROR;
+            break;
+        }
+
+        if (wSectorCount)
+        {
+            MMCRunPause();
+        }
+    }
+
+    MMCPutByte(MMC_TOKEN_STOP_TRAN);
+    MMCPutByte(0xff);
+    if (MMCWaitReady() != MMC_OK)
+    {
+        nError = MMC_ERROR;
+    }
+
+    MMCEnd();
+
+    return(nError);
+} /* WriteMultiSectors */
+
 /************************************************************/
 /*  WriteSectors                                            */
 /************************************************************/
@@ -431,32 +716,32 @@ static BYTE WriteSectors(DRIVE *pDrive, BYTE *pBuffer, DWORD dStartSector, WORD
         if (MMCGet() == 0xff)
         {
             nError = MMC_ERROR;
-            SPIdeselect();
+            MMCEnd();
             break;
         }
 
-        SPIputByte(0xfe);  // Send Start Byte
+        MMCPutByte(0xfe);  // Send Start Byte
 
-        for (wDataCount=0; wDataCount<512; wDataCount++)
-        { /* read the sector */
-            SPIputByte(*pBuffer);
-            pBuffer++;
-        }
+        MMCWriteBlock(pBuffer);  /* write the sector */
+        pBuffer += 512;
 
-        SPIputByte(0xff);  /* checksum -> don't care about it for now */
-        SPIputByte(0xff);  /* checksum -> don't care about it for now */
-        SPIputByte(0xff);  /* Read "data response byte"               */
+        MMCPutByte(0xff);  /* checksum -> don't care about it for now */
+        MMCPutByte(0xff);  /* checksum -> don't care about it for now */
+        MMCPutByte(0xff);  /* Read "data response byte"               */
 
         wDataCount = 0xffff;
-        while ((SPIgetByte() == 0x00) && (--wDataCount)); /* wait for write finish */
+        while ((MMCGetByte() == 0x00) && (--wDataCount)); /* wait for write finish */
         if (wDataCount == 0)
         {
             nError = MMC_ERROR;
-            SPIdeselect();
+            MMCEnd();
             break;
         }
 
-        SPIdeselect();
+        MMCEnd();
+
+        /* let the decoder feed and other threads have the bus */
+        NutThreadYield();
     }
 
     return(nError);
@@ -488,6 +773,10 @@ int MMCInit(int nMMCMode, MMC_MOUNT_FUNC *pMountFunc,
 
     MMCSemaInit();
 
+#if (MMC_TRANSPORT == MMC_TRANSPORT_USART)
+    MMCUsartInit();
+#endif
+
     nError = InitMMCCard();
     if (nError == MMC_OK)
     {
@@ -651,16 +940,23 @@ int MMCReadSectors(BYTE bDevice, void *pData, DWORD dwStartSector, WORD wSectorC
             while (wSectorCount > 0)
             {
 
-                if (wSectorCount < 256)
+                if (wSectorCount < MMC_MAX_RUN)
                 {
                     wReadCount = wSectorCount;
                 }
                 else
                 {
-                    wReadCount = 256;
+                    wReadCount = MMC_MAX_RUN;
                 }
 
-                nError = ReadSectors(pDrive, pByte, dwStartSector, wReadCount);
+                if (wReadCount > 1)
+                {
+                    nError = ReadMultiSectors(pDrive, pByte, dwStartSector, wReadCount);
+                }
+                else
+                {
+                    nError = ReadSectors(pDrive, pByte, dwStartSector, wReadCount);
+                }
                 if (nError != MMC_OK)
                 {
                     break;
@@ -669,6 +965,9 @@ int MMCReadSectors(BYTE bDevice, void *pData, DWORD dwStartSector, WORD wSectorC
                 dwStartSector += wReadCount;
                 wSectorCount -= wReadCount;
                 pByte += (wReadCount * pDrive->wSectorSize);
+
+                /* the bus is free again, let the decoder feed run */
+                NutThreadYield();
             }
         }
         else
@@ -726,16 +1025,23 @@ int MMCWriteSectors(BYTE   bDevice,      void *pData,
         while (wSectorCount > 0)
         {
 
-            if (wSectorCount < 256)
+            if (wSectorCount < MMC_MAX_RUN)
             {
                 wWriteCount = wSectorCount;
             }
             else
             {
-                wWriteCount = 256;
+                wWriteCount = MMC_MAX_RUN;
             }
 
-            nError = WriteSectors(pDrive, pByte, dwStartSector, wWriteCount);
+            if (wWriteCount > 1)
+            {
+                nError = WriteMultiSectors(pDrive, pByte, dwStartSector, wWriteCount);
+            }
+            else
+            {
+                nError = WriteSectors(pDrive, pByte, dwStartSector, wWriteCount);
+            }
             if (nError != MMC_OK)
             {
                 break;
@@ -744,6 +1050,9 @@ int MMCWriteSectors(BYTE   bDevice,      void *pData,
             dwStartSector += wWriteCount;
             wSectorCount  -= wWriteCount;
             pByte         += (wWriteCount * MMC_SECTOR_SIZE);
+
+            /* the bus is free again, let the decoder feed run */
+            NutThreadYield();
         }
     }
 
@@ -0,0 +1,401 @@
+/* ========================================================================
+ * [PROJECT]    SIR
+ * [MODULE]     Mp3Frame
+ * [TITLE]      MPEG audio frame synchronisation
+ * [FILE]       mp3frame.c
+ * [VSN]        1.0
+ * [CREATED]    17102026
+ * [LASTCHNGD]  17102026
+ * [COPYRIGHT]  Copyright (C) STREAMIT BV 2010
+ * [PURPOSE]    locates MPEG audio frame headers in the received stream,
+ *              removes junk and truncated frames before they reach the
+ *              decoder and reports the format of the stream
+ * ======================================================================== */
+
+#define LOG_MODULE  LOG_STREAMER_MODULE
+
+/*-------------------------------------------------------------------------*/
+/* includes                                                                */
+/*-------------------------------------------------------------------------*/
+#include <string.h>
+
+#include "system.h"
+#include "platform.h"
+#include "log.h"
+#include "mp3frame.h"
+
+/*-------------------------------------------------------------------------*/
+/* local defines                                                           */
+/*-------------------------------------------------------------------------*/
+/*
+ *  header bits which are constant within a stream:
+ *  sync, version, layer and protection in byte 1, samplerate in byte 2
+ */
+#define MP3_REF_MASK1       0xFF
+#define MP3_REF_MASK2       0x0C
+
+/*-------------------------------------------------------------------------*/
+/* local variable definitions                                              */
+/*-------------------------------------------------------------------------*/
+/*
+ *  bitrates in kbit/s, index 0 (free format) and 15 are invalid
+ */
+static prog_char br_v1l1[15] = { 0, 4, 8, 12, 16, 20, 24, 28, 32, 36, 40, 44, 48, 52, 56 };    /* x 8 */
+static prog_char br_v1l2[15] = { 0, 4, 6, 7, 8, 10, 12, 14, 16, 20, 24, 28, 32, 40, 48 };      /* x 8 */
+static prog_char br_v1l3[15] = { 0, 4, 5, 6, 7, 8, 10, 12, 14, 16, 20, 24, 28, 32, 40 };       /* x 8 */
+static prog_char br_v2l1[15] = { 0, 4, 6, 7, 8, 10, 12, 14, 16, 18, 20, 22, 24, 28, 32 };      /* x 8 */
+static prog_char br_v2l3[15] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 10, 12, 14, 16, 18, 20 };          /* x 8, layer 2 and 3 */
+
+static prog_int sr_v1[3] = { 441, 480, 320 };                                         /* x 100 Hz */
+
+/*-------------------------------------------------------------------------*/
+/* local routines (prototyping)                                            */
+/*-------------------------------------------------------------------------*/
+static int Mp3SyncMatch(MP3SYNC *ms, CONST u_char *cp);
+static void Mp3SyncTrack(MP3SYNC *ms, MP3FRAMEINFO *fi);
+
+/*!
+ * \addtogroup Mp3Frame
+ */
+
+/*@{*/
+
+/*-------------------------------------------------------------------------*/
+/*                         start of code                                   */
+/*-------------------------------------------------------------------------*/
+
+/*!
+ * \brief decode and validate an MPEG audio frame header
+ *
+ * \param cp points to the 4 header bytes
+ * \param fi receives the decoded header
+ *
+ * \return 0 if this is a valid header, -1 otherwise
+ */
+int Mp3FrameHeader(CONST u_char *cp, MP3FRAMEINFO *fi)
+{
+    u_char idx;
+    u_char pad;
+    PGM_P tab;
+
+    if (cp[0] != 0xFF || (cp[1] & 0xE0) != 0xE0)
+    {
+        return(-1);
+    }
+
+    switch ((cp[1] >> 3) & 3)
+    {
+        case 0:  fi->fi_version = MP3_MPEG25; break;
+        case 2:  fi->fi_version = MP3_MPEG2;  break;
+        case 3:  fi->fi_version = MP3_MPEG1;  break;
+        default: return(-1);
+    }
+
+    fi->fi_layer = 4 - ((cp[1] >> 1) & 3);
+    if (fi->fi_layer > 3)
+    {
+        return(-1);
+    }
+
+    /* Reject free format, bad bitrate, reserved samplerate and emphasis. */
+    idx = cp[2] >> 4;
+    if (idx == 0 || idx == 15 || (cp[2] & 0x0C) == 0x0C || (cp[3] & 3) == 2)
+    {
+        return(-1);
+    }
+
+    if (fi->fi_version == MP3_MPEG1)
+    {
+        tab = fi->fi_layer == 1 ? br_v1l1 : (fi->fi_layer == 2 ? br_v1l2 : br_v1l3);
+    }
+    else
+    {
+        tab = fi->fi_layer == 1 ? br_v2l1 : br_v2l3;
+    }
+    fi->fi_bitrate = (u_short) PRG_RDB(tab + idx) * 8;
+
+    fi->fi_samplerate = (u_short) (PRG_RDW(&sr_v1[(cp[2] >> 2) & 3]) * 100);
+    if (fi->fi_version == MP3_MPEG2)
+    {
+        fi->fi_samplerate >>= 1;
+    }
+    else if (fi->fi_version == MP3_MPEG25)
+    {
+        fi->fi_samplerate >>= 2;
+    }
+
+    fi->fi_mode = cp[3] >> 6;
+
+    pad = (cp[2] >> 1) & 1;
+    if (fi->fi_layer == 1)
+    {
+        fi->fi_length = (u_short) ((12000UL * fi->fi_bitrate / fi->fi_samplerate + pad) * 4);
+    }
+    else if (fi->fi_layer == 3 && fi->fi_version != MP3_MPEG1)
+    {
+        fi->fi_length = (u_short) (72000UL * fi->fi_bitrate / fi->fi_samplerate + pad);
+    }
+    else
+    {
+        fi->fi_length = (u_short) (144000UL * fi->fi_bitrate / fi->fi_samplerate + pad);
+    }
+    return(0);
+}
+
+/*!
+ * \brief check whether a header belongs to the stream we are locked to
+ */
+static int Mp3SyncMatch(MP3SYNC *ms, CONST u_char *cp)
+{
+    return(ms->ms_locked &&
+           ms->ms_ref[1] == (cp[1] & MP3_REF_MASK1) &&
+           ms->ms_ref[2] == (cp[2] & MP3_REF_MASK2));
+}
+
+/*!
+ * \brief update statistics and detect format changes
+ */
+static void Mp3SyncTrack(MP3SYNC *ms, MP3FRAMEINFO *fi)
+{
+    if (ms->ms_frames && fi->fi_bitrate != ms->ms_info.fi_bitrate && ms->ms_vbr == 0)
+    {
+        ms->ms_vbr = 1;
+        ms->ms_changed = 1;
+    }
+    if (ms->ms_frames == 0)
+    {
+        ms->ms_bravg = fi->fi_bitrate << MP3_BRAVG_SHIFT;
+    }
+    else
+    {
+        ms->ms_bravg += fi->fi_bitrate - (ms->ms_bravg >> MP3_BRAVG_SHIFT);
+    }
+    if (fi->fi_bitrate > ms->ms_brmax)
+    {
+        ms->ms_brmax = fi->fi_bitrate;
+        if (ms->ms_vbr)
+        {
+            ms->ms_changed = 1;
+        }
+    }
+    if (fi->fi_version != ms->ms_info.fi_version ||
+        fi->fi_layer != ms->ms_info.fi_layer ||
+        fi->fi_samplerate != ms->ms_info.fi_samplerate ||
+        fi->fi_mode != ms->ms_info.fi_mode)
+    {
+        ms->ms_changed = 1;
+    }
+    ms->ms_info = *fi;
+    ms->ms_frames++;
+}
+
+/*!
+ * \brief initialise the frame sync stage for a new stream
+ */
+void Mp3SyncInit(MP3SYNC *ms)
+{
+    memset(ms, 0, sizeof(MP3SYNC));
+    ms->ms_state = MP3_SYNC_HUNT;
+}
+
+/*!
+ * \brief restart synchronisation after the stream was interrupted
+ *
+ * An incomplete frame which is still held back is dropped. Statistics
+ * and the reference format are kept, so the first frame of the
+ * reconnected stream is accepted without further confirmation.
+ */
+void Mp3SyncRestart(MP3SYNC *ms)
+{
+    ms->ms_dropped += ms->ms_held;
+    ms->ms_held = 0;
+    ms->ms_scan = 0;
+    ms->ms_frameleft = 0;
+    if (ms->ms_state != MP3_SYNC_BYPASS)
+    {
+        ms->ms_state = MP3_SYNC_HUNT;
+    }
+}
+
+/*!
+ * \brief pass received data through the frame sync stage
+ *
+ * The first ms_held bytes of buf are the ones held back by the
+ * previous call, new data follows them. Junk is removed in place.
+ *
+ * \param ms  frame sync state
+ * \param buf start of the write window
+ * \param len number of valid bytes in buf, incl. held bytes
+ *
+ * \return number of bytes at the start of buf which contain complete
+ *         frames and may be committed. A frame is complete when the
+ *         header of the next one has been verified. The remaining bytes
+ *         are held and ms_held is updated accordingly.
+ */
+size_t Mp3SyncFilter(MP3SYNC *ms, u_char *buf, size_t len)
+{
+    size_t pos = ms->ms_scan;           /* next byte to check */
+    size_t dst = ms->ms_scan;           /* end of accepted data */
+    size_t last = 0;                    /* end of the last complete frame */
+    size_t n;
+    MP3FRAMEINFO fi;
+    MP3FRAMEINFO nfi;
+    u_char ok;
+
+    if (ms->ms_state == MP3_SYNC_BYPASS)
+    {
+        ms->ms_held = 0;
+        ms->ms_scan = 0;
+        return(len);
+    }
+
+    while (pos < len)
+    {
+        /* copy the body of the current frame */
+        if (ms->ms_frameleft)
+        {
+            n = len - pos;
+            if (n > ms->ms_frameleft)
+            {
+                n = ms->ms_frameleft;
+            }
+            if (dst != pos)
+            {
+                memmove(buf + dst, buf + pos, n);
+            }
+            dst += n;
+            pos += n;
+            ms->ms_frameleft -= n;
+            continue;
+        }
+
+        /* need a complete header */
+        if (len - pos < 4)
+        {
+            break;
+        }
+
+        ok = 0;
+        if (Mp3FrameHeader(buf + pos, &fi) == 0)
+        {
+            if (ms->ms_state == MP3_SYNC_LOCKED)
+            {
+                ok = Mp3SyncMatch(ms, buf + pos);
+            }
+            else if (pos + fi.fi_length + 4 <= len)
+            {
+                /* confirm by the header of the following frame */
+                ok = Mp3FrameHeader(buf + pos + fi.fi_length, &nfi) == 0 &&
+                     buf[pos + 1] == buf[pos + fi.fi_length + 1] &&
+                     (buf[pos + 2] & MP3_REF_MASK2) == (buf[pos + fi.fi_length + 2] & MP3_REF_MASK2);
+            }
+            else if (Mp3SyncMatch(ms, buf + pos))
+            {
+                ok = 1;
+            }
+            else
+            {
+                /* wait for more data before deciding */
+                break;
+            }
+        }
+
+        if (ok)
+        {
+            /* the previous frame is complete */
+            last = dst;
+            if (ms->ms_state != MP3_SYNC_LOCKED)
+            {
+                ms->ms_state = MP3_SYNC_LOCKED;
+                ms->ms_locked = 1;
+                ms->ms_ref[1] = buf[pos + 1] & MP3_REF_MASK1;
+                ms->ms_ref[2] = buf[pos + 2] & MP3_REF_MASK2;
+            }
+            Mp3SyncTrack(ms, &fi);
+            ms->ms_frameleft = fi.fi_length;
+            continue;
+        }
+
+        /* junk follows, so the previous frame was truncated */
+        if (ms->ms_state == MP3_SYNC_LOCKED)
+        {
+            ms->ms_state = MP3_SYNC_HUNT;
+            ms->ms_resyncs++;
+            ms->ms_dropped += dst - last;
+            dst = last;
+        }
+
+        /* drop one byte and search on */
+        pos++;
+        ms->ms_dropped++;
+        if (ms->ms_locked == 0 && ++ms->ms_hunted >= MP3_SYNC_GIVEUP)
+        {
+            LogMsg_P(LOG_WARNING, PSTR("No MPEG frames, sync disabled"));
+            ms->ms_state = MP3_SYNC_BYPASS;
+            n = len - pos;
+            memmove(buf + dst, buf + pos, n);
+            dst += n;
+            pos += n;
+            last = dst;
+        }
+    }
+
+    /* keep the incomplete tail together for the next call */
+    n = len - pos;
+    if (n && dst != pos)
+    {
+        memmove(buf + dst, buf + pos, n);
+    }
+    ms->ms_scan = (u_short) (dst - last);
+    ms->ms_held = (u_short) (dst + n - last);
+
+    return(last);
+}
+
+/*!
+ * \brief release held bytes when they fill the complete write window
+ *
+ * Bytes of a frame in progress are passed on, the rest of the frame
+ * follows with the next window. Anything that has not been verified
+ * yet is dropped.
+ *
+ * \return number of bytes at the start of the window to commit
+ */
+size_t Mp3SyncFlush(MP3SYNC *ms)
+{
+    size_t n = 0;
+
+    if (ms->ms_state == MP3_SYNC_LOCKED)
+    {
+        n = ms->ms_scan;
+        if (ms->ms_scan < ms->ms_held)
+        {
+            /* header of the next frame is incomplete */
+            ms->ms_state = MP3_SYNC_HUNT;
+            ms->ms_frameleft = 0;
+        }
+    }
+    ms->ms_dropped += ms->ms_held - n;
+    ms->ms_held = 0;
+    ms->ms_scan = 0;
+
+    return(n);
+}
+
+/*!
+ * \brief log the format of the stream
+ */
+void Mp3SyncReport(MP3SYNC *ms)
+{
+    static char *modes[4] = { "stereo", "joint stereo", "dual channel", "mono" };
+    MP3FRAMEINFO *fi = &ms->ms_info;
+
+    LogMsg_P(LOG_INFO, PSTR("MPEG%s layer %u, %u kbit/s%s, %u Hz, %s"),
+             fi->fi_version == MP3_MPEG1 ? "1" : (fi->fi_version == MP3_MPEG2 ? "2" : "2.5"),
+             fi->fi_layer, ms->ms_vbr ? ms->ms_brmax : fi->fi_bitrate, ms->ms_vbr ? " VBR" : "",
+             fi->fi_samplerate, modes[fi->fi_mode]);
+}
+
+/* ---------- end of module ------------------------------------------------ */
+
+/*@}*/
@@ -0,0 +1,267 @@
+/* ========================================================================
+ * [PROJECT]    SIR
+ * [MODULE]     Playlist
+ * [TITLE]      stream playlist
+ * [FILE]       playlist.c
+ * [VSN]        1.0
+ * [CREATED]    17102026
+ * [LASTCHNGD]  17102026
+ * [COPYRIGHT]  Copyright (C) STREAMIT BV 2010
+ * [PURPOSE]    keeps the candidate URLs of a station and parses .pls and
+ *              .m3u playlists while they are received
+ * ======================================================================== */
+
+#define LOG_MODULE  LOG_STREAMER_MODULE
+
+/*-------------------------------------------------------------------------*/
+/* includes                                                                */
+/*-------------------------------------------------------------------------*/
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+#include "system.h"
+#include "log.h"
+#include "playlist.h"
+
+/*-------------------------------------------------------------------------*/
+/* local defines                                                           */
+/*-------------------------------------------------------------------------*/
+#define PL_STATE_LINE       0       /* collecting the start of a line */
+#define PL_STATE_URL        1       /* copying a URL into the table */
+#define PL_STATE_SKIP       2       /* ignore rest of line */
+
+/*-------------------------------------------------------------------------*/
+/* local routines (prototyping)                                            */
+/*-------------------------------------------------------------------------*/
+static void PlaylistEol(PLAYLIST *pl);
+
+/*!
+ * \addtogroup Playlist
+ */
+
+/*@{*/
+
+/*-------------------------------------------------------------------------*/
+/*                         start of code                                   */
+/*-------------------------------------------------------------------------*/
+
+/*!
+ * \brief clear the URL table and reset the parser
+ */
+void PlaylistInit(PLAYLIST *pl)
+{
+    memset(pl, 0, sizeof(PLAYLIST));
+}
+
+/*!
+ * \brief add a single URL to the table
+ *
+ * \return 0 on success, -1 if the table is full or the URL too long
+ */
+int PlaylistAdd(PLAYLIST *pl, CONST char *url)
+{
+    if (pl->pl_count >= PL_MAX_URLS || strlen(url) >= PL_URL_SIZE)
+    {
+        return(-1);
+    }
+    strcpy(pl->pl_url[pl->pl_count++], url);
+    return(0);
+}
+
+/*!
+ * \brief finish the current line
+ */
+static void PlaylistEol(PLAYLIST *pl)
+{
+    if (pl->pl_state == PL_STATE_URL && pl->pl_len)
+    {
+        /* trim trailing blanks */
+        while (pl->pl_len && pl->pl_url[pl->pl_count][pl->pl_len - 1] == ' ')
+        {
+            pl->pl_len--;
+        }
+        pl->pl_url[pl->pl_count][pl->pl_len] = 0;
+        LogMsg_P(LOG_INFO, PSTR("Playlist entry %s"), pl->pl_url[pl->pl_count]);
+        pl->pl_count++;
+    }
+    pl->pl_state = PL_STATE_LINE;
+    pl->pl_len = 0;
+}
+
+/*!
+ * \brief feed the next character of a playlist into the parser
+ *
+ * Stream URLs are taken from 'FileN=' lines of .pls files and from
+ * all lines of .m3u files starting with 'http://'. Anything else is
+ * ignored, as are URLs which don't fit into the table.
+ *
+ * \param pl URL table, initialised with PlaylistInit()
+ * \param ch received character
+ *
+ * \return 0 if more characters may follow, -1 if the playlist exceeds
+ *         PL_MAXSIZE
+ */
+int PlaylistPut(PLAYLIST *pl, char ch)
+{
+    if (++pl->pl_total > PL_MAXSIZE)
+    {
+        PlaylistEol(pl);
+        return(-1);
+    }
+
+    if (ch == '\r')
+    {
+        return(0);
+    }
+    if (ch == '\n')
+    {
+        PlaylistEol(pl);
+        return(0);
+    }
+
+    switch (pl->pl_state)
+    {
+        case PL_STATE_LINE:
+            if (pl->pl_len == 0 && (ch == ' ' || ch == '\t'))
+            {
+                break;
+            }
+            if (pl->pl_count >= PL_MAX_URLS)
+            {
+                pl->pl_state = PL_STATE_SKIP;
+                break;
+            }
+            if (ch == '=' && pl->pl_len >= 4 && strncasecmp(pl->pl_win, "file", 4) == 0)
+            {
+                /* .pls entry */
+                pl->pl_state = PL_STATE_URL;
+                pl->pl_len = 0;
+                break;
+            }
+            pl->pl_win[pl->pl_len++] = ch;
+            if (pl->pl_len == 7)
+            {
+                if (strncasecmp(pl->pl_win, "http://", 7) == 0)
+                {
+                    /* .m3u entry, keep what we have seen so far */
+                    memcpy(pl->pl_url[pl->pl_count], pl->pl_win, 7);
+                    pl->pl_state = PL_STATE_URL;
+                }
+                else if (strncasecmp(pl->pl_win, "file", 4) != 0)
+                {
+                    pl->pl_state = PL_STATE_SKIP;
+                }
+            }
+            else if (pl->pl_len >= PL_WINDOW_SIZE)
+            {
+                /* 'FileNNN=' doesn't fit, nobody has that many entries */
+                pl->pl_state = PL_STATE_SKIP;
+            }
+            break;
+
+        case PL_STATE_URL:
+            if (pl->pl_len < PL_URL_SIZE - 1)
+            {
+                pl->pl_url[pl->pl_count][pl->pl_len++] = ch;
+            }
+            else
+            {
+                LogMsg_P(LOG_WARNING, PSTR("Playlist URL too long"));
+                pl->pl_state = PL_STATE_SKIP;
+                pl->pl_len = 0;
+            }
+            break;
+    }
+    return(0);
+}
+
+/*!
+ * \brief get the next candidate URL
+ *
+ * Cycles through the table, so repeated calls fail over from one
+ * entry to the next.
+ *
+ * \return pointer to the URL or NULL if the table is empty
+ */
+CONST char *PlaylistNext(PLAYLIST *pl)
+{
+    CONST char *url;
+
+    if (pl->pl_count == 0)
+    {
+        return(NULL);
+    }
+    if (pl->pl_current >= pl->pl_count)
+    {
+        pl->pl_current = 0;
+    }
+    url = pl->pl_url[pl->pl_current++];
+
+    return(url);
+}
+
+/*!
+ * \brief check whether a response contains a playlist
+ *
+ * \param type content-type of the response, may be empty
+ * \param path path of the request
+ *
+ * \return PL_PLS, PL_M3U or PL_NONE
+ */
+u_char PlaylistType(CONST char *type, CONST char *path)
+{
+    CONST char *ext = strrchr(path, '.');
+
+    if (strcasecmp(type, "audio/x-scpls") == 0 || (ext && strcasecmp(ext, ".pls") == 0))
+    {
+        return(PL_PLS);
+    }
+    if (strcasecmp(type, "audio/x-mpegurl") == 0 || strcasecmp(type, "audio/mpegurl") == 0 ||
+        (ext && strcasecmp(ext, ".m3u") == 0))
+    {
+        return(PL_M3U);
+    }
+    return(PL_NONE);
+}
+
+/*!
+ * \brief split an http URL into its parts
+ *
+ * The URL is modified in place.
+ *
+ * \param url  'http://host[:port][/path]'
+ * \param host receives a pointer to the host name
+ * \param port receives the port number, 80 if none is given
+ * \param path receives a pointer to the path without leading slash
+ *
+ * \return 0 on success, -1 if this is not an http URL
+ */
+int PlaylistSplitUrl(char *url, char **host, u_short *port, char **path)
+{
+    char *cp;
+
+    if (strncasecmp(url, "http://", 7) != 0)
+    {
+        return(-1);
+    }
+    *host = url + 7;
+    *port = 80;
+    *path = "";
+
+    if ((cp = strchr(*host, '/')) != NULL)
+    {
+        *cp++ = 0;
+        *path = cp;
+    }
+    if ((cp = strchr(*host, ':')) != NULL)
+    {
+        *cp++ = 0;
+        *port = (u_short) atoi(cp);
+    }
+    return(**host ? 0 : -1);
+}
+
+/* ---------- end of module ------------------------------------------------ */
+
+/*@}*/
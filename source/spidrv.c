@@ -26,18 +26,68 @@
 #include "vs10xx.h"
 
 #include <sys/timer.h>
+#include <sys/thread.h>
+#include <sys/event.h>
 
 /*-------------------------------------------------------------------------*/
 /* local defines                                                           */
 /*-------------------------------------------------------------------------*/
+/*
+ * wait until the byte in the shift register is done
+ */
+#define SPI_WAIT()          loop_until_bit_is_set(SPSR, SPIF)
+
+/*
+ * single steps of the block routines. The next byte is fetched (or the
+ * received one stored) while the current byte is shifting, only the
+ * SPDR access is left between SPIF and the start of the next byte
+ */
+#define SPI_WRITE_NEXT()    { data = *pData++; SPI_WAIT(); SPDR = data; }
+#define SPI_READ_NEXT()     { SPI_WAIT(); data = SPDR; SPDR = 0xFF; *pData++ = data; }
+#define SPI_EXCHANGE_NEXT() { next = *pTx++; SPI_WAIT(); data = SPDR; SPDR = next; *pRx++ = data; }
+
+#ifdef SPI_BENCHMARK
+#define SPI_BENCH_LEN       512
+#endif
 /*-------------------------------------------------------------------------*/
 /* typedefs & structs                                                      */
 /*-------------------------------------------------------------------------*/
+/*!
+ * \brief SPI unit configuration of a device
+ */
+typedef struct
+{
+    u_char spcr;
+    u_char spsr;
+} TSPIConfig;
+
 /*-------------------------------------------------------------------------*/
 /* local variable definitions                                              */
 /*-------------------------------------------------------------------------*/
 static u_char g_Speedmode;
 
+/*
+ * configuration per device, see SPIselect() for the clockrates
+ */
+static TSPIConfig g_Config[SPI_NROF_DEVICES] =
+{
+    { BV(MSTR) | BV(SPE) | BV(SPR0), BV(SPI2X) },  // VS10XX data, Fosc/8 until SPImode()
+    { BV(MSTR) | BV(SPE),            BV(SPI2X) },  // flash, Fosc/2
+    { BV(MSTR) | BV(SPE),            0         },  // MMC/SD, Fosc/4
+    { BV(MSTR) | BV(SPE) | BV(SPR0), BV(SPI2X) }   // VS10XX command, Fosc/8
+};
+
+/*
+ * configuration last written to the SPI unit
+ */
+static TSPIConfig g_Active;
+
+/*
+ * bus arbitration: thread holding the bus and threads waiting for it
+ */
+static NUTTHREADINFO *g_BusOwner;
+static HANDLE g_BusQueue;
+
 /*-------------------------------------------------------------------------*/
 /* local routines (prototyping)                                            */
 /*-------------------------------------------------------------------------*/
@@ -68,66 +118,28 @@ static u_char g_Speedmode;
  * 1     0    1:  fosc/8  = 542 ns  -> 1.8432 MHz
  * 0     0    1:  fosc/16 = 1085 ns -> 0.9216 MHz
  *
+ * The SPI unit is only reconfigured if the device needs another
+ * configuration than the one last used. No arbitration is done here,
+ * threads use SPIbegin().
  */
 
 void SPIselect(TSPIDevice Device)
 {
+    TSPIConfig *pConfig = &g_Config[Device];
 
-    // set SPI-speed for selected device
-    if (Device==SPI_DEV_VS10XX)
-    {
-        if (g_Speedmode==SPEED_SLOW)
-        {
-            // set speed to Fosc/8
-            outb(SPSR, BV(SPI2X));
-            outb(SPCR, BV(MSTR) | BV(SPE) | BV(SPR0));
-        }
-        else if (g_Speedmode==SPEED_FAST)
-        {
-            // set speed to Fosc/4
-            outb(SPSR, 0);
-            outb(SPCR, BV(MSTR) | BV(SPE));
-        }
-        else if (g_Speedmode==SPEED_ULTRA_FAST)
-        {
-            // set speed to Fosc/2
-            outb(SPSR, BV(SPI2X));
-            outb(SPCR, BV(MSTR) | BV(SPE));
-        }
-        else
-        {
-            LogMsg_P(LOG_ERR,PSTR("invalid Speed"));
-        }
-    }
-    else if (Device==SPI_DEV_FLASH)
+    // only touch the SPI unit if the configuration changes
+    if (pConfig->spcr != g_Active.spcr || pConfig->spsr != g_Active.spsr)
     {
-        // set speed for flash to Fosc/2
-        outb(SPSR, BV(SPI2X));
-        outb(SPCR, BV(MSTR) | BV(SPE));
-    }
-    else
-    {
-        // set speed for flash to Fosc/2
-//        outb(SPSR, BV(SPI2X));
-//        outb(SPCR, BV(MSTR) | BV(SPE));
-
-        // set speed for card to Fosc/4
-        outb(SPSR, 0);
-        outb(SPCR, BV(MSTR) | BV(SPE));
-
-        // set speed for card to Fosc/8
-//        outb(SPSR, BV(SPI2X));
-//        outb(SPCR, BV(MSTR) | BV(SPE) | BV(SPR0));
-
-        // set speed for card to Fosc/16
-//        outb(SPSR, 0);
-//        outb(SPCR, BV(MSTR) | BV(SPE) | BV(SPR0));
+        outb(SPSR, pConfig->spsr);
+        outb(SPCR, pConfig->spcr);
+        g_Active = *pConfig;
     }
 
     // enable selected device
     switch (Device)
     {
         case SPI_DEV_VS10XX:
+        case SPI_DEV_VS10XX_CMD:
             {
                 sbi(FLASH_OUT_WRITE, FLASH_ENABLE);    // disable serial Flash
                 sbi(MMCVS_OUT_WRITE, MMC_ENABLE);      // disable MMC/SDHC
@@ -163,12 +175,94 @@ void SPIdeselect()
     sbi(MMCVS_OUT_WRITE, MMC_ENABLE);      // disable MMC/SDHC
 }
 
+/*!
+ * \brief start a transaction with a device
+ *
+ * Waits until no other thread holds the bus and selects the device.
+ * The decoder interrupt handler doesn't wait, it leaves the bus alone
+ * while SPIbusy() and is called again by SPIend(). Thus the decoder
+ * interrupt mask is never touched here.
+ *
+ * The thread holding the bus may call this again to select another
+ * device, a single SPIend() releases the bus.
+ *
+ * Must not be called from interrupt context.
+ */
+void SPIbegin(TSPIDevice Device)
+{
+    if (g_BusOwner != runningThread)
+    {
+        while (g_BusOwner)
+        {
+            NutEventWait(&g_BusQueue, NUT_WAIT_INFINITE);
+        }
+        g_BusOwner = runningThread;
+    }
+    SPIselect(Device);
+}
+
+/*!
+ * \brief end a transaction
+ *
+ * Deselects all devices and releases the bus. The decoder may have
+ * asked for data while the bus was held, so it is fed before any
+ * waiting thread gets the bus.
+ */
+void SPIend(void)
+{
+    SPIdeselect();
+
+    if (g_BusOwner == runningThread)
+    {
+        g_BusOwner = 0;
+        VsPlayerRefill();
+        NutEventPostAsync(&g_BusQueue);
+    }
+}
+
+/*!
+ * \brief check if a thread holds the bus
+ *
+ * For interrupt handlers, which can't wait in SPIbegin().
+ */
+u_char SPIbusy(void)
+{
+    return(g_BusOwner != 0);
+}
+
 /*!
  * \brief not all devices can operate always on maximum speed. This routine determines the several speed modes.
  *
+ * Sets the clockrate used for VS10XX data (SDI) transfers. Commands
+ * (SCI) use SPI_DEV_VS10XX_CMD, which always runs at SPEED_SLOW.
  */
 void SPImode(u_char data)
 {
+    TSPIConfig *pConfig = &g_Config[SPI_DEV_VS10XX];
+
+    if (data==SPEED_SLOW)
+    {
+        // set speed to Fosc/8
+        pConfig->spsr = BV(SPI2X);
+        pConfig->spcr = BV(MSTR) | BV(SPE) | BV(SPR0);
+    }
+    else if (data==SPEED_FAST)
+    {
+        // set speed to Fosc/4
+        pConfig->spsr = 0;
+        pConfig->spcr = BV(MSTR) | BV(SPE);
+    }
+    else if (data==SPEED_ULTRA_FAST)
+    {
+        // set speed to Fosc/2
+        pConfig->spsr = BV(SPI2X);
+        pConfig->spcr = BV(MSTR) | BV(SPE);
+    }
+    else
+    {
+        LogMsg_P(LOG_ERR,PSTR("invalid Speed"));
+        return;
+    }
     g_Speedmode = data;
 }
 
@@ -208,6 +302,105 @@ u_char SPItransferByte(u_char data)
     return(SPDR);                    // return with byte shifted in from receiver
 }
 
+/*!
+ * \brief send a block using SPI, ignore result
+ *
+ * Unrolled 4 times. Safe to use from interrupt context, the bus must
+ * be held (or be owned by the interrupted thread's SPIbegin() caller).
+ */
+void SPIwriteBlock(CONST u_char *pData, u_short wLen)
+{
+    u_char data;
+
+    if (wLen == 0)
+    {
+        return;
+    }
+
+    SPDR = *pData++;
+    wLen--;
+
+    while (wLen >= 4)
+    {
+        SPI_WRITE_NEXT();
+        SPI_WRITE_NEXT();
+        SPI_WRITE_NEXT();
+        SPI_WRITE_NEXT();
+        wLen -= 4;
+    }
+    while (wLen--)
+    {
+        SPI_WRITE_NEXT();
+    }
+    SPI_WAIT();
+}
+
+/*!
+ * \brief read a block using SPI, sending 0xFF
+ *
+ * Unrolled 4 times.
+ */
+void SPIreadBlock(u_char *pData, u_short wLen)
+{
+    u_char data;
+
+    if (wLen == 0)
+    {
+        return;
+    }
+
+    SPDR = 0xFF;
+    wLen--;
+
+    while (wLen >= 4)
+    {
+        SPI_READ_NEXT();
+        SPI_READ_NEXT();
+        SPI_READ_NEXT();
+        SPI_READ_NEXT();
+        wLen -= 4;
+    }
+    while (wLen--)
+    {
+        SPI_READ_NEXT();
+    }
+    SPI_WAIT();
+    *pData = SPDR;
+}
+
+/*!
+ * \brief send a block using SPI, store the bytes read the same time
+ *
+ * Unrolled 4 times. pRx may be equal to pTx.
+ */
+void SPIexchangeBlock(CONST u_char *pTx, u_char *pRx, u_short wLen)
+{
+    u_char data, next;
+
+    if (wLen == 0)
+    {
+        return;
+    }
+
+    SPDR = *pTx++;
+    wLen--;
+
+    while (wLen >= 4)
+    {
+        SPI_EXCHANGE_NEXT();
+        SPI_EXCHANGE_NEXT();
+        SPI_EXCHANGE_NEXT();
+        SPI_EXCHANGE_NEXT();
+        wLen -= 4;
+    }
+    while (wLen--)
+    {
+        SPI_EXCHANGE_NEXT();
+    }
+    SPI_WAIT();
+    *pRx = SPDR;
+}
+
 /*!
  * \brief Initialise SPI registers (speed)
  *
@@ -222,6 +415,67 @@ void SPIinit()
     sbi(MMCVS_OUT_WRITE, MMC_ENABLE);      // disable MMC/SDHC
 }
 
+#ifdef SPI_BENCHMARK
+/*!
+ * \brief log the cycles per byte of the transfer routines
+ *
+ * Clocks SPI_BENCH_LEN bytes with every routine at the flash and at the
+ * MMC/SD clockrate. No device is selected while doing so. Timer 3 runs
+ * at the CPU clock to count cycles, interrupts are off while measuring.
+ */
+void SPIbenchmark(void)
+{
+    static u_char Buffer[SPI_BENCH_LEN];
+    static prog_char Devices[] = { SPI_DEV_FLASH, SPI_DEV_MMC };
+    u_short wCycles[4];
+    u_short i;
+    u_char d;
+
+    TCCR3A = 0;
+    TCCR3B = BV(CS30);
+
+    for (d = 0; d < sizeof(Devices); d++)
+    {
+        SPIbegin(PRG_RDB(&Devices[d]));
+        SPIdeselect();
+
+        NutEnterCritical();
+
+        TCNT3 = 0;
+        for (i = 0; i < SPI_BENCH_LEN; i++)
+        {
+            SPIputByte(Buffer[i]);
+        }
+        wCycles[0] = TCNT3;
+
+        TCNT3 = 0;
+        SPIwriteBlock(Buffer, SPI_BENCH_LEN);
+        wCycles[1] = TCNT3;
+
+        TCNT3 = 0;
+        SPIreadBlock(Buffer, SPI_BENCH_LEN);
+        wCycles[2] = TCNT3;
+
+        TCNT3 = 0;
+        SPIexchangeBlock(Buffer, Buffer, SPI_BENCH_LEN);
+        wCycles[3] = TCNT3;
+
+        NutExitCritical();
+
+        SPIend();
+
+        LogMsg_P(LOG_INFO, PSTR("dev %d cycles/byte x10: put %u write %u read %u exchange %u"),
+                 PRG_RDB(&Devices[d]),
+                 (u_short)(wCycles[0] * 10UL / SPI_BENCH_LEN),
+                 (u_short)(wCycles[1] * 10UL / SPI_BENCH_LEN),
+                 (u_short)(wCycles[2] * 10UL / SPI_BENCH_LEN),
+                 (u_short)(wCycles[3] * 10UL / SPI_BENCH_LEN));
+    }
+
+    TCCR3B = 0;
+}
+#endif
+
 
 /*    End Of File    */
 
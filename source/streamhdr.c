@@ -0,0 +1,333 @@
+/* ========================================================================
+ * [PROJECT]    SIR
+ * [MODULE]     StreamHdr
+ * [TITLE]      stream response header parser
+ * [FILE]       streamhdr.c
+ * [VSN]        1.0
+ * [CREATED]    17102026
+ * [LASTCHNGD]  17102026
+ * [COPYRIGHT]  Copyright (C) STREAMIT BV 2010
+ * [PURPOSE]    incremental parser for the response header of Shoutcast,
+ *              Icecast and plain HTTP servers. Works on single characters
+ *              with a small fixed window, no line buffer is needed
+ * ======================================================================== */
+
+#define LOG_MODULE  LOG_STREAMER_MODULE
+
+/*-------------------------------------------------------------------------*/
+/* includes                                                                */
+/*-------------------------------------------------------------------------*/
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+#include "system.h"
+#include "log.h"
+#include "streamhdr.h"
+
+/*-------------------------------------------------------------------------*/
+/* local defines                                                           */
+/*-------------------------------------------------------------------------*/
+/*
+ *  parser states
+ */
+#define SH_STATE_STATUS     0       /* status line */
+#define SH_STATE_NAME       1       /* header name up to the colon */
+#define SH_STATE_VALUE      2       /* header value */
+#define SH_STATE_SKIP       3       /* ignore rest of line */
+#define SH_STATE_DONE       4
+#define SH_STATE_ERROR      5
+
+/*
+ *  header fields we are interested in, index into field_names
+ */
+#define SH_FIELD_NONE       0
+#define SH_FIELD_METAINT    1
+#define SH_FIELD_BITRATE    2
+#define SH_FIELD_NAME       3
+#define SH_FIELD_TYPE       4
+#define SH_FIELD_LOCATION   5
+
+/*-------------------------------------------------------------------------*/
+/* local variable definitions                                              */
+/*-------------------------------------------------------------------------*/
+static prog_char field_names[][SH_WINDOW_SIZE] =
+{
+    "",
+    "icy-metaint",
+    "icy-br",
+    "icy-name",
+    "content-type",
+    "location"
+};
+
+/*-------------------------------------------------------------------------*/
+/* local routines (prototyping)                                            */
+/*-------------------------------------------------------------------------*/
+static int StreamHdrStatus(STREAMHDR *sh);
+static char *StreamHdrTarget(STREAMHDR *sh, u_char *size);
+static int StreamHdrEol(STREAMHDR *sh);
+static void StreamHdrValue(STREAMHDR *sh, char ch);
+
+/*!
+ * \addtogroup StreamHdr
+ */
+
+/*@{*/
+
+/*-------------------------------------------------------------------------*/
+/*                         start of code                                   */
+/*-------------------------------------------------------------------------*/
+
+/*!
+ * \brief parse the status line prefix kept in the window
+ *
+ * Accepts 'ICY 200 OK' as sent by Shoutcast as well as 'HTTP/1.x 200 OK'.
+ *
+ * \return 0 if this is a valid status line, -1 otherwise
+ */
+static int StreamHdrStatus(STREAMHDR *sh)
+{
+    char *cp;
+
+    sh->sh_win[sh->sh_len] = 0;
+    if (strncmp_P(sh->sh_win, PSTR("ICY "), 4) != 0 && strncmp_P(sh->sh_win, PSTR("HTTP/1."), 7) != 0)
+    {
+        return(-1);
+    }
+    if ((cp = strchr(sh->sh_win, ' ')) == NULL)
+    {
+        return(-1);
+    }
+    sh->sh_info->si_status = (u_short) atoi(cp + 1);
+
+    return(sh->sh_info->si_status ? 0 : -1);
+}
+
+/*!
+ * \brief get the string field the current value is stored in
+ *
+ * \return pointer to the field or NULL if the current field is numeric
+ */
+static char *StreamHdrTarget(STREAMHDR *sh, u_char *size)
+{
+    switch (sh->sh_field)
+    {
+        case SH_FIELD_NAME:
+            *size = SH_NAME_SIZE;
+            return(sh->sh_info->si_name);
+        case SH_FIELD_TYPE:
+            *size = SH_TYPE_SIZE;
+            return(sh->sh_info->si_type);
+        case SH_FIELD_LOCATION:
+            *size = SH_LOCATION_SIZE;
+            return(sh->sh_info->si_location);
+    }
+    return(NULL);
+}
+
+/*!
+ * \brief store one character of a header value
+ */
+static void StreamHdrValue(STREAMHDR *sh, char ch)
+{
+    char *dst;
+    u_char size;
+
+    /* skip leading blanks */
+    if (sh->sh_len == 0 && (ch == ' ' || ch == '\t'))
+    {
+        return;
+    }
+
+    if (sh->sh_field == SH_FIELD_METAINT || sh->sh_field == SH_FIELD_BITRATE)
+    {
+        /* numbers end at the first non-digit, e.g. 'icy-br: 128,128' */
+        if (!isdigit((u_char) ch))
+        {
+            sh->sh_state = SH_STATE_SKIP;
+        }
+        else if (sh->sh_field == SH_FIELD_METAINT)
+        {
+            sh->sh_info->si_metaint = sh->sh_info->si_metaint * 10 + (ch - '0');
+        }
+        else
+        {
+            sh->sh_info->si_bitrate = sh->sh_info->si_bitrate * 10 + (ch - '0');
+        }
+        sh->sh_len++;
+        return;
+    }
+
+    dst = StreamHdrTarget(sh, &size);
+    if (sh->sh_len < size - 1)
+    {
+        dst[sh->sh_len++] = ch;
+        if (ch != ' ' && ch != '\t')
+        {
+            sh->sh_end = sh->sh_len;
+        }
+    }
+    else if (sh->sh_field == SH_FIELD_LOCATION)
+    {
+        /* a truncated URL is useless */
+        LogMsg_P(LOG_WARNING, PSTR("Location too long"));
+        dst[0] = 0;
+        sh->sh_state = SH_STATE_SKIP;
+    }
+}
+
+/*!
+ * \brief handle the end of a line
+ */
+static int StreamHdrEol(STREAMHDR *sh)
+{
+    char *dst;
+    u_char size;
+
+    switch (sh->sh_state)
+    {
+        case SH_STATE_STATUS:
+            if (StreamHdrStatus(sh))
+            {
+                LogMsg_P(LOG_ERR, PSTR("Bad status line"));
+                sh->sh_state = SH_STATE_ERROR;
+                return(SH_ERROR);
+            }
+            break;
+
+        case SH_STATE_NAME:
+            /* the header ends with an empty line */
+            if (sh->sh_len == 0)
+            {
+                sh->sh_state = SH_STATE_DONE;
+                return(SH_DONE);
+            }
+            break;
+
+        case SH_STATE_VALUE:
+            if ((dst = StreamHdrTarget(sh, &size)) != NULL)
+            {
+                dst[sh->sh_end] = 0;
+            }
+            break;
+    }
+
+    sh->sh_state = SH_STATE_NAME;
+    sh->sh_field = SH_FIELD_NONE;
+    sh->sh_len = 0;
+    sh->sh_end = 0;
+
+    return(SH_MORE);
+}
+
+/*!
+ * \brief initialise the parser for a new response
+ *
+ * \param sh parser state
+ * \param si receives the header information, cleared here
+ */
+void StreamHdrInit(STREAMHDR *sh, STREAMINFO *si)
+{
+    memset(sh, 0, sizeof(STREAMHDR));
+    memset(si, 0, sizeof(STREAMINFO));
+    sh->sh_info = si;
+    sh->sh_state = SH_STATE_STATUS;
+}
+
+/*!
+ * \brief feed the next character of the response into the parser
+ *
+ * Lines may end with CR/LF or LF only. Lines which don't fit into
+ * the window or values which don't fit into their field are truncated,
+ * unknown header lines are ignored.
+ *
+ * \param sh parser state
+ * \param ch received character
+ *
+ * \return SH_MORE if more characters are needed, SH_DONE at the end of
+ *         the header or SH_ERROR if the response is not acceptable
+ */
+int StreamHdrPut(STREAMHDR *sh, char ch)
+{
+    u_char i;
+
+    if (sh->sh_state == SH_STATE_DONE)
+    {
+        return(SH_DONE);
+    }
+    if (sh->sh_state == SH_STATE_ERROR)
+    {
+        return(SH_ERROR);
+    }
+    if (++sh->sh_total > SH_MAXHEADER)
+    {
+        LogMsg_P(LOG_ERR, PSTR("Header exceeds %u bytes"), SH_MAXHEADER);
+        sh->sh_state = SH_STATE_ERROR;
+        return(SH_ERROR);
+    }
+
+    if (ch == '\r')
+    {
+        return(SH_MORE);
+    }
+    if (ch == '\n')
+    {
+        return(StreamHdrEol(sh));
+    }
+
+    switch (sh->sh_state)
+    {
+        case SH_STATE_STATUS:
+            if (sh->sh_len < SH_WINDOW_SIZE - 1)
+            {
+                sh->sh_win[sh->sh_len++] = ch;
+            }
+            break;
+
+        case SH_STATE_NAME:
+            if (ch == ':')
+            {
+                sh->sh_win[sh->sh_len] = 0;
+                for (i = SH_FIELD_LOCATION; i > SH_FIELD_NONE; i--)
+                {
+                    if (strcmp_P(sh->sh_win, field_names[i]) == 0)
+                    {
+                        break;
+                    }
+                }
+                sh->sh_field = i;
+                sh->sh_state = i == SH_FIELD_NONE ? SH_STATE_SKIP : SH_STATE_VALUE;
+                sh->sh_len = 0;
+
+                /* a repeated header replaces the earlier value */
+                if (i == SH_FIELD_METAINT)
+                {
+                    sh->sh_info->si_metaint = 0;
+                }
+                else if (i == SH_FIELD_BITRATE)
+                {
+                    sh->sh_info->si_bitrate = 0;
+                }
+            }
+            else if (sh->sh_len < SH_WINDOW_SIZE - 1)
+            {
+                sh->sh_win[sh->sh_len++] = tolower((u_char) ch);
+            }
+            else
+            {
+                /* longer than any name we know */
+                sh->sh_state = SH_STATE_SKIP;
+            }
+            break;
+
+        case SH_STATE_VALUE:
+            StreamHdrValue(sh, ch);
+            break;
+    }
+    return(SH_MORE);
+}
+
+/* ---------- end of module ------------------------------------------------ */
+
+/*@}*/
@@ -0,0 +1,164 @@
+/* ========================================================================
+ * [PROJECT]    SIR
+ * [MODULE]     StreamStats
+ * [TITLE]      playback telemetry
+ * [FILE]       streamstats.c
+ * [VSN]        1.0
+ * [CREATED]    17102026
+ * [LASTCHNGD]  17102026
+ * [COPYRIGHT]  Copyright (C) STREAMIT BV 2010
+ * [PURPOSE]    collects throughput, buffer occupancy and decoder statistics
+ *              of the running stream and prints them as text or JSON
+ * ======================================================================== */
+
+#define LOG_MODULE  LOG_STREAMER_MODULE
+
+/*-------------------------------------------------------------------------*/
+/* includes                                                                */
+/*-------------------------------------------------------------------------*/
+#include <string.h>
+#include <stdio.h>
+
+#include <sys/timer.h>
+
+#include "system.h"
+#include "streamstats.h"
+#include "vs10xx.h"
+
+/*-------------------------------------------------------------------------*/
+/* global variable definitions                                             */
+/*-------------------------------------------------------------------------*/
+STREAMSTATS streamstats;
+
+/*!
+ * \addtogroup StreamStats
+ */
+
+/*@{*/
+
+/*-------------------------------------------------------------------------*/
+/*                         start of code                                   */
+/*-------------------------------------------------------------------------*/
+
+/*!
+ * \brief clear all statistics at the start of playback
+ */
+void StreamStatsInit(void)
+{
+    memset(&streamstats, 0, sizeof(STREAMSTATS));
+    streamstats.ss_start = NutGetMillis();
+    streamstats.ss_win_start = streamstats.ss_start;
+    streamstats.ss_hist_last = streamstats.ss_start;
+}
+
+/*!
+ * \brief count received bytes
+ *
+ * \param bytes number of bytes received from the network
+ */
+void StreamStatsRx(size_t bytes)
+{
+    u_long now = NutGetMillis();
+    u_long elapsed;
+
+    streamstats.ss_rx_bytes += bytes;
+    streamstats.ss_win_bytes += bytes;
+
+    elapsed = now - streamstats.ss_win_start;
+    if (elapsed >= SS_RATE_WINDOW)
+    {
+        /* one bit per ms is one kbit/s */
+        streamstats.ss_kbps = (u_short) ((streamstats.ss_win_bytes * 8) / elapsed);
+        streamstats.ss_win_bytes = 0;
+        streamstats.ss_win_start = now;
+    }
+}
+
+/*!
+ * \brief sample the buffer occupancy
+ *
+ * The time since the previous sample is added to the histogram
+ * bucket of the current level.
+ *
+ * \param used bytes in the buffer
+ * \param size total size of the buffer
+ */
+void StreamStatsLevel(u_long used, u_long size)
+{
+    u_long now = NutGetMillis();
+    u_char bucket = 0;
+
+    if (size)
+    {
+        bucket = (u_char) ((used * SS_HIST_BUCKETS) / size);
+        if (bucket >= SS_HIST_BUCKETS)
+        {
+            bucket = SS_HIST_BUCKETS - 1;
+        }
+    }
+    streamstats.ss_hist[bucket] += now - streamstats.ss_hist_last;
+    streamstats.ss_hist_last = now;
+}
+
+/*!
+ * \brief get the average throughput since the start of playback
+ *
+ * \return throughput in kbit/s
+ */
+u_short StreamStatsAverage(void)
+{
+    u_long elapsed = NutGetMillis() - streamstats.ss_start;
+
+    if (elapsed == 0)
+    {
+        return(0);
+    }
+    return((u_short) ((streamstats.ss_rx_bytes * 8) / elapsed));
+}
+
+/*!
+ * \brief print the statistics
+ *
+ * \param stream output stream
+ * \param json   print a JSON object if not zero, 'name=value' lines otherwise
+ */
+void StreamStatsPrint(FILE *stream, u_char json)
+{
+    static prog_char json_fmt_P[] =
+        "{\"uptime\":%lu,\"rx_bytes\":%lu,\"kbps\":%u,\"avg_kbps\":%u,"
+        "\"underruns\":%lu,\"kicks\":%lu,\"metablocks\":%lu,\"reconnects\":%lu,\"hist\":[";
+    static prog_char text_fmt_P[] =
+        "uptime=%lu\r\nrx_bytes=%lu\r\nkbps=%u\r\navg_kbps=%u\r\n"
+        "underruns=%lu\r\nkicks=%lu\r\nmetablocks=%lu\r\nreconnects=%lu\r\nhist=";
+    static prog_char json_dec_P[] =
+        "],\"decoder\":{\"format\":\"%04X\",\"kbps\":%u,\"samplerate\":%u,\"channels\":%u,\"time\":%u}}\r\n";
+    static prog_char text_dec_P[] =
+        "\r\nformat=%04X\r\ndec_kbps=%u\r\nsamplerate=%u\r\nchannels=%u\r\ndecode_time=%u\r\n";
+    u_long now = NutGetMillis();
+    u_short kbps = streamstats.ss_kbps;
+    u_char i;
+    VSDECODERINFO di;
+
+    /* the window is only closed by received data */
+    if (now - streamstats.ss_win_start > 2 * SS_RATE_WINDOW)
+    {
+        kbps = 0;
+    }
+
+    fprintf_P(stream, json ? json_fmt_P : text_fmt_P,
+              (now - streamstats.ss_start) / 1000, streamstats.ss_rx_bytes, kbps, StreamStatsAverage(),
+              streamstats.ss_underruns, streamstats.ss_kicks, streamstats.ss_metablocks, streamstats.ss_reconnects);
+    for (i = 0; i < SS_HIST_BUCKETS; i++)
+    {
+        fprintf_P(stream, PSTR("%s%lu"), i ? "," : "", streamstats.ss_hist[i]);
+    }
+
+    /* the last sample taken by the player, no decoder access here */
+    VsDecoderInfo(&di);
+    fprintf_P(stream, json ? json_dec_P : text_dec_P,
+              di.di_format, di.di_bitrate, di.di_samplerate, di.di_channels, di.di_time);
+}
+
+/* ---------- end of module ------------------------------------------------ */
+
+/*@}*/
@@ -0,0 +1,200 @@
+/* ========================================================================
+ * [PROJECT]    SIR
+ * [MODULE]     ToneCtrl
+ * [TITLE]      bass/treble presets
+ * [FILE]       tonectrl.c
+ * [VSN]        1.0
+ * [CREATED]    17102026
+ * [LASTCHNGD]  17102026
+ * [COPYRIGHT]  Copyright (C) STREAMIT BV 2010
+ * [PURPOSE]    named bass/treble presets for the decoder, the selected
+ *              preset is kept in the parameter page of the dataflash
+ * ======================================================================== */
+
+#define LOG_MODULE  LOG_SETTINGS_MODULE
+
+/*-------------------------------------------------------------------------*/
+/* includes                                                                */
+/*-------------------------------------------------------------------------*/
+#include <string.h>
+
+#include "system.h"
+#include "platform.h"
+#include "log.h"
+#include "flash.h"
+#include "tonectrl.h"
+
+/*-------------------------------------------------------------------------*/
+/* local defines                                                           */
+/*-------------------------------------------------------------------------*/
+#define TONE_PARAM_MAGIC    0x54    /* marks valid settings in the parameter page */
+
+/*-------------------------------------------------------------------------*/
+/* typedefs & structs                                                      */
+/*-------------------------------------------------------------------------*/
+/*!
+ * \brief tone settings as stored in the parameter page
+ */
+typedef struct _TONEPARAM
+{
+    u_char      tp_magic;               /* TONE_PARAM_MAGIC */
+    u_char      tp_preset;              /* TONE_PRESET_FLAT etc. */
+    VSTONECTRL  tp_custom;              /* settings of TONE_PRESET_CUSTOM */
+} TONEPARAM;
+
+/*-------------------------------------------------------------------------*/
+/* local variable definitions                                              */
+/*-------------------------------------------------------------------------*/
+/*
+ * treble, treble frequency (kHz), bass, bass frequency (10 Hz) per preset
+ */
+static prog_char preset_tab[TONE_PRESETS - 1][4] =
+{
+    {  0, 10,  0, 10 },                 // flat
+    {  0, 10, 12,  6 },                 // bass
+    {  5,  6,  0, 10 },                 // treble
+    {  4,  8, 10,  8 },                 // loud
+    { -2, 10,  0, 15 }                  // voice, cut the hiss
+};
+
+static prog_char preset_names[] = "Flat\0Bass\0Treble\0Loud\0Voice\0Custom";
+
+static TONEPARAM toneparam;
+
+/*!
+ * \addtogroup ToneCtrl
+ */
+
+/*@{*/
+
+/*-------------------------------------------------------------------------*/
+/*                         start of code                                   */
+/*-------------------------------------------------------------------------*/
+
+/*!
+ * \brief apply a preset to the decoder
+ */
+static int ToneCtrlApply(u_char preset)
+{
+    VSTONECTRL tc;
+
+    if (preset == TONE_PRESET_CUSTOM)
+    {
+        return(VsSetTone(&toneparam.tp_custom));
+    }
+    tc.tc_treble = (signed char)PRG_RDB(&preset_tab[preset][0]);
+    tc.tc_treble_khz = PRG_RDB(&preset_tab[preset][1]);
+    tc.tc_bass = PRG_RDB(&preset_tab[preset][2]);
+    tc.tc_bass_hz10 = PRG_RDB(&preset_tab[preset][3]);
+
+    return(VsSetTone(&tc));
+}
+
+/*!
+ * \brief store the settings in the parameter page
+ *
+ * The flash page is only rewritten if the settings changed.
+ */
+static int ToneCtrlSave(void)
+{
+    if (At45dbParamWrite(TONE_PARAM_POS, &toneparam, sizeof(TONEPARAM)))
+    {
+        LogMsg_P(LOG_ERR, PSTR("can't store tone settings"));
+        return(-1);
+    }
+    return(0);
+}
+
+/*!
+ * \brief load the stored settings and apply them
+ *
+ * Falls back to the flat preset if the parameter page holds no valid
+ * settings. Must be called after At45dbInit().
+ *
+ * \return 0 if stored settings have been found, -1 otherwise
+ */
+int ToneCtrlInit(void)
+{
+    int rc = 0;
+
+    if (At45dbParamRead(TONE_PARAM_POS, &toneparam, sizeof(TONEPARAM)) ||
+        toneparam.tp_magic != TONE_PARAM_MAGIC || toneparam.tp_preset >= TONE_PRESETS)
+    {
+        memset(&toneparam, 0, sizeof(TONEPARAM));
+        toneparam.tp_magic = TONE_PARAM_MAGIC;
+        toneparam.tp_preset = TONE_PRESET_FLAT;
+        toneparam.tp_custom.tc_treble_khz = 10;
+        toneparam.tp_custom.tc_bass_hz10 = 10;
+        rc = -1;
+    }
+    ToneCtrlApply(toneparam.tp_preset);
+
+    return(rc);
+}
+
+/*!
+ * \brief select a preset and store it
+ *
+ * \param preset TONE_PRESET_FLAT etc.
+ *
+ * \return 0 on success, -1 otherwise
+ */
+int ToneCtrlSelect(u_char preset)
+{
+    if (preset >= TONE_PRESETS)
+    {
+        return(-1);
+    }
+    toneparam.tp_preset = preset;
+    ToneCtrlApply(preset);
+
+    return(ToneCtrlSave());
+}
+
+/*!
+ * \brief set the custom preset, select it and store it
+ *
+ * \param tc new settings
+ *
+ * \return 0 on success, -1 otherwise
+ */
+int ToneCtrlSetCustom(CONST VSTONECTRL *tc)
+{
+    toneparam.tp_custom = *tc;
+
+    return(ToneCtrlSelect(TONE_PRESET_CUSTOM));
+}
+
+/*!
+ * \brief return the selected preset
+ */
+u_char ToneCtrlCurrent(void)
+{
+    return(toneparam.tp_preset);
+}
+
+/*!
+ * \brief return the name of a preset
+ *
+ * \param preset TONE_PRESET_FLAT etc.
+ *
+ * \return name in program space, 0 if there is no such preset
+ */
+PGM_P ToneCtrlName(u_char preset)
+{
+    PGM_P name = preset_names;
+
+    if (preset >= TONE_PRESETS)
+    {
+        return(0);
+    }
+    while (preset--)
+    {
+        name += strlen_P(name) + 1;
+    }
+    return(name);
+}
+
+/* ---------- end of module ------------------------------------------------ */
+
+/*@}*/
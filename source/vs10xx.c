@@ -44,11 +44,13 @@
 #define LOG_MODULE  LOG_VS10XX_MODULE
 
 #include <stdlib.h>
+#include <string.h>
 
 #include <sys/atom.h>
 #include <sys/event.h>
 #include <sys/timer.h>
 #include <sys/heap.h>
+#include <sys/thread.h>
 
 #include <dev/irqreg.h>
 
@@ -63,6 +65,7 @@
 #include "vs10xx.h"
 #include "platform.h"
 #include "log.h"
+#include "mp3frame.h"
 #include "portio.h"    // for debug purposes only
 #include "spidrv.h"    // for debug purposes only
 #include "watchdog.h"
@@ -82,8 +85,9 @@
 #define MONO        0
 #define STEREO      1
 
-#define VsDeselectVs()  SPIdeselect()
-#define VsSelectVs()    SPIselect(SPI_DEV_VS10XX)
+#define VsDeselectVs()  SPIend()
+#define VsSelectVs()    SPIbegin(SPI_DEV_VS10XX)
+#define VsSelectSci()   SPIbegin(SPI_DEV_VS10XX_CMD)
 
 
 /*-------------------------------------------------------------------------*/
@@ -93,101 +97,197 @@ static volatile u_char vs_status = VS_STATUS_STOPPED;
 static u_short g_vs_type;
 static u_char VsPlayMode;
 
+/*
+ * Set once the patch code has been loaded into the decoder, any
+ * reset of the decoder discards it.
+ */
+static u_char vs_patched;
+
+/*
+ * Registers that only change when we write them. Reads of these are
+ * served from vs_shadow once it holds a valid copy, all others are
+ * read from the decoder each time.
+ */
+#define VS_SHADOW_REGS  ((1 << VS_MODE_REG) | (1 << VS_BASS_REG) | (1 << VS_CLOCKF_REG) | (1 << VS_VOL_REG))
+
+#define VsShadowed(reg) ((reg) < NROF_VS_REGS && ((1 << (reg)) & VS_SHADOW_REGS))
+
+static u_short vs_shadow[NROF_VS_REGS];
+static u_short vs_shadow_valid;
+
+/*
+ * Volume ramping. While a ramp is active, a periodic timer wakes the
+ * service thread every VS_RAMP_TICK ms, which moves SCI_VOL one step
+ * closer to the target level.
+ */
+#define VS_RAMP_TICK        10
+#define VS_SERVICE_STACK    384
+
+static u_char vs_vol_user[2];       /* level set by VsSetVolume() */
+static u_char vs_vol_cur[2];        /* level written to the decoder */
+static u_char vs_vol_target[2];     /* level the ramp is heading for */
+static u_char vs_duck;              /* attenuation added by VsDuck() */
+static u_short vs_ramp_ticks;       /* ticks left until target is reached */
+static HANDLE vs_ramp_timer;
+static HANDLE vs_service_evt;
+static u_char vs_service_started;
+
+/*
+ * Tone queue. Each entry is played for its duration, a oneshot timer
+ * asks the service thread for the next one. Stream data is held back
+ * while tones are playing.
+ */
+#define VS_TONE_QUEUE       16
+
+typedef struct _VSTONE
+{
+    u_char  tn_raw;                     /* sine test value, 0 for a rest */
+    u_short tn_ms;                      /* duration */
+} VSTONE;
+
+static VSTONE vs_tone_q[VS_TONE_QUEUE];
+static u_char vs_tone_head;
+static u_char vs_tone_count;
+static volatile u_char vs_tone_active;  /* set while the queue is played */
+static volatile u_char vs_tone_due;     /* set by the timer, next tone is due */
+static u_char vs_tone_sine;             /* set while a sine is generated */
+static u_short vs_tone_mode;            /* mode to restore when done */
+
+/*
+ * Minimum time between two samples of the decoder status registers.
+ */
+#define VS_INFO_PERIOD      1000
+
+static VSDECODERINFO vs_info;
+
+/*
+ * Last value requested for SCI_BASS, restored after a decoder reset.
+ */
+static u_short vs_bass;
+
+/*
+ * Set once VsPlayerInit() has brought up the decoder.
+ */
+static u_char vs_ready;
+
+/*
+ * Spectrum analyzer plugin. The number of bands is found at
+ * VS_SA_BANDS_ADDR, the band levels start at VS_SA_DATA_ADDR.
+ */
+#define VS_SA_BANDS_ADDR    0x1802
+#define VS_SA_DATA_ADDR     0x1804
+#define VS_SA_LEVEL_MASK    0x3F
+
+/*
+ * SPI time budget of the analyzer. A single SCI read at SPEED_SLOW
+ * takes about VS_SCI_READ_US including overhead. Band values are read
+ * no more often than VS_SA_BUDGET_US per second allows.
+ */
+#define VS_SCI_READ_US      30
+#define VS_SA_BUDGET_US     10000
+#define VS_SA_MIN_PERIOD    50
+
+/*
+ * DREQ polls allowed for a whole run of register words, a few ms.
+ * Enough for the decoder to process each word, see VsRegWriteRun().
+ */
+#define VS_RUN_DREQ_POLLS   20000
+
+static CONST u_short *vs_sa_plugin;
+static u_short vs_sa_words;
+static u_char vs_sa_bands;
+static u_short vs_sa_period;
+static u_long vs_sa_stamp;
+static u_char vs_sa_level[VS_SA_MAX_BANDS];
+
 
 static void VsLoadProgramCode(void);
+static void VsToneStep(void);
 
 /*-------------------------------------------------------------------------*/
 /* local routines (prototyping)                                            */
 /*-------------------------------------------------------------------------*/
 
-#define CODE_SIZE 437
-static prog_char atab[CODE_SIZE] = { /* Register addresses */
-    7, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
-    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
-    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
-    6, 6, 6, 6, 6, 6, 6, 6, 6, 7, 6, 6, 6, 6, 6, 6,
-    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
-    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
-    6, 6, 6, 6, 7, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
-    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
-    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
-    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
-    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
-    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
-    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
-    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
-    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
-    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 7, 6, 6,
-    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
-    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
-    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
-    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
-    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
-    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
-    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
-    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
-    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
-    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
-    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
-    6, 6, 6, 6, 6
-};
+/*
+ * Number of words read back from the start of each block of patch
+ * code to verify that it is still resident.
+ */
+#define CODE_SAMPLES 4
 
-prog_int dtab[CODE_SIZE] = { /* Data to write */
-    0x8030, 0x0030, 0x0717, 0xb080, 0x3c17, 0x0006, 0x5017, 0x3f00,
-    0x0024, 0x0006, 0x2016, 0x0012, 0x578f, 0x0000, 0x10ce, 0x2912,
-    0x9900, 0x0000, 0x004d, 0x4080, 0x184c, 0x0006, 0x96d7, 0x2800,
-    0x0d55, 0x0000, 0x0d48, 0x0006, 0x5b50, 0x3009, 0x0042, 0xb080,
-    0x8001, 0x4214, 0xbc40, 0x2818, 0xc740, 0x3613, 0x3c42, 0x3e00,
-    0xb803, 0x0014, 0x1b03, 0x0015, 0x59c2, 0x6fd6, 0x0024, 0x3600,
-    0x9803, 0x2812, 0x57d5, 0x0000, 0x004d, 0x2800, 0x2b40, 0x36f3,
-    0x0024, 0x804c, 0x3e10, 0x3814, 0x3e10, 0x780a, 0x3e13, 0xb80d,
-    0x3e03, 0xf805, 0x0006, 0x5595, 0x3009, 0x1415, 0x001b, 0xffd4,
-    0x0003, 0xffce, 0x0001, 0x000a, 0x2400, 0x16ce, 0xb58a, 0x0024,
-    0xf292, 0x9400, 0x6152, 0x0024, 0xfe02, 0x0024, 0x48b2, 0x0024,
-    0x454a, 0xb601, 0x36f3, 0xd805, 0x36f3, 0x980d, 0x36f0, 0x580a,
-    0x2000, 0x0000, 0x36f0, 0x1814, 0x8061, 0x3613, 0x0024, 0x3e12,
-    0xb817, 0x3e12, 0x3815, 0x3e05, 0xb814, 0x3625, 0x0024, 0x0000,
-    0x800a, 0x3e10, 0xb803, 0x4194, 0xb805, 0x3e11, 0x0024, 0x3e11,
-    0xb807, 0x3e14, 0x7812, 0x3e14, 0xf80d, 0x3e03, 0xf80e, 0x0006,
-    0x0051, 0x2800, 0x24d5, 0x0000, 0x0024, 0xb888, 0x0012, 0x6404,
-    0x0405, 0x0000, 0x0024, 0x2800, 0x2158, 0x4094, 0x0024, 0x2400,
-    0x2102, 0x0000, 0x0024, 0x6498, 0x0803, 0xfe56, 0x0024, 0x48b6,
-    0x0024, 0x4dd6, 0x0024, 0x3a10, 0xc024, 0x32f0, 0xc024, 0xfe56,
-    0x0024, 0x48b6, 0x0024, 0x4dd6, 0x0024, 0x4384, 0x4483, 0x6396,
-    0x888c, 0xf400, 0x40d5, 0x3d00, 0x8024, 0x0006, 0x0091, 0x003f,
-    0xfec3, 0x0006, 0x0053, 0x3101, 0x8024, 0xfe60, 0x0024, 0x48be,
-    0x0024, 0xa634, 0x0c03, 0x4324, 0x0024, 0x4284, 0x2c02, 0x0006,
-    0x0011, 0x2800, 0x24d8, 0x3100, 0x8024, 0x0006, 0x5011, 0x3900,
-    0x8024, 0x0006, 0x0011, 0x3100, 0x984c, 0x4284, 0x904c, 0xf400,
-    0x4088, 0x2800, 0x2845, 0x0000, 0x0024, 0x3cf0, 0x3840, 0x3009,
-    0x3841, 0x3009, 0x3810, 0x2000, 0x0000, 0x0000, 0x2788, 0x3009,
-    0x1bd0, 0x2800, 0x2880, 0x3009, 0x1b81, 0x34f3, 0x1bcc, 0x36f3,
-    0xd80e, 0x36f4, 0xd80d, 0x36f4, 0x5812, 0x36f1, 0x9807, 0x36f1,
-    0x1805, 0x36f0, 0x9803, 0x3405, 0x9014, 0x36f3, 0x0024, 0x36f2,
-    0x1815, 0x2000, 0x0000, 0x36f2, 0x9817, 0x80ad, 0x3e12, 0xb817,
-    0x3e12, 0x3815, 0x3e05, 0xb814, 0x3615, 0x0024, 0x0000, 0x800a,
-    0x3e10, 0x7802, 0x3e10, 0xf804, 0x3e11, 0x7810, 0x3e14, 0x7812,
-    0x2913, 0xc980, 0x3e14, 0xc024, 0x2913, 0xc980, 0x4088, 0x184c,
-    0xf400, 0x4005, 0x0000, 0x18c0, 0x6400, 0x0024, 0x0000, 0x1bc0,
-    0x2800, 0x3095, 0x0030, 0x0310, 0x2800, 0x3f80, 0x3801, 0x4024,
-    0x6400, 0x0024, 0x0000, 0x1a40, 0x2800, 0x3755, 0x0006, 0x55d0,
-    0x0000, 0x7d03, 0xb884, 0x184c, 0x3009, 0x3805, 0x3009, 0x0000,
-    0xff8a, 0x0024, 0x291d, 0x7b00, 0x48b2, 0x0024, 0x0000, 0x1841,
-    0x0006, 0x5010, 0x408a, 0xb844, 0x2900, 0x1300, 0x4088, 0x0024,
-    0x3000, 0x1bcc, 0x6014, 0x0024, 0x0030, 0x0351, 0x2800, 0x36d5,
-    0x0000, 0x0024, 0x0006, 0x0011, 0x3100, 0x0024, 0x0030, 0x0351,
-    0x3800, 0x0024, 0x2800, 0x3f80, 0x3901, 0x4024, 0x6400, 0x0024,
-    0x0030, 0x03d0, 0x2800, 0x3f55, 0x0000, 0x7d03, 0x0006, 0x55d0,
-    0xb884, 0x184c, 0x3009, 0x3805, 0x3009, 0x0000, 0xff8a, 0x0024,
-    0x291d, 0x7b00, 0x48b2, 0x0024, 0x408a, 0x9bcc, 0x0000, 0x1841,
-    0x2800, 0x3b55, 0x0006, 0x5010, 0x689a, 0x0024, 0x3000, 0x0024,
-    0x6014, 0x0024, 0x0030, 0x0392, 0x2800, 0x3e85, 0x0006, 0x0091,
-    0x0006, 0x0011, 0x0000, 0x1852, 0x0006, 0x0053, 0xb880, 0x2400,
-    0x0006, 0x0091, 0x3804, 0x8024, 0x0030, 0x0392, 0x3b00, 0x0024,
-    0x3901, 0x4024, 0x2800, 0x3f80, 0x3a01, 0x4024, 0x3801, 0x4024,
-    0xb880, 0x1bd3, 0x36f4, 0x5812, 0x36f1, 0x5810, 0x36f0, 0xd804,
-    0x36f0, 0x5802, 0x3405, 0x9014, 0x36f3, 0x0024, 0x36f2, 0x1815,
-    0x2000, 0x0000, 0x36f2, 0x9817, 0x0030
+/*
+ * Decoder patch in VLSI's compressed plugin format. Each run starts with
+ * the register address and a count. If bit 15 of the count is set, the
+ * single word that follows is written count & 0x7FFF times, otherwise
+ * count literal words follow.
+ */
+static prog_int vs_patch[] = {
+    0x0007, 0x0001,
+    0x8030,
+    0x0006, 0x0038,
+    0x0030, 0x0717, 0xb080, 0x3c17, 0x0006, 0x5017, 0x3f00, 0x0024,
+    0x0006, 0x2016, 0x0012, 0x578f, 0x0000, 0x10ce, 0x2912, 0x9900,
+    0x0000, 0x004d, 0x4080, 0x184c, 0x0006, 0x96d7, 0x2800, 0x0d55,
+    0x0000, 0x0d48, 0x0006, 0x5b50, 0x3009, 0x0042, 0xb080, 0x8001,
+    0x4214, 0xbc40, 0x2818, 0xc740, 0x3613, 0x3c42, 0x3e00, 0xb803,
+    0x0014, 0x1b03, 0x0015, 0x59c2, 0x6fd6, 0x0024, 0x3600, 0x9803,
+    0x2812, 0x57d5, 0x0000, 0x004d, 0x2800, 0x2b40, 0x36f3, 0x0024,
+    0x0007, 0x0001,
+    0x804c,
+    0x0006, 0x002a,
+    0x3e10, 0x3814, 0x3e10, 0x780a, 0x3e13, 0xb80d, 0x3e03, 0xf805,
+    0x0006, 0x5595, 0x3009, 0x1415, 0x001b, 0xffd4, 0x0003, 0xffce,
+    0x0001, 0x000a, 0x2400, 0x16ce, 0xb58a, 0x0024, 0xf292, 0x9400,
+    0x6152, 0x0024, 0xfe02, 0x0024, 0x48b2, 0x0024, 0x454a, 0xb601,
+    0x36f3, 0xd805, 0x36f3, 0x980d, 0x36f0, 0x580a, 0x2000, 0x0000,
+    0x36f0, 0x1814,
+    0x0007, 0x0001,
+    0x8061,
+    0x0006, 0x0098,
+    0x3613, 0x0024, 0x3e12, 0xb817, 0x3e12, 0x3815, 0x3e05, 0xb814,
+    0x3625, 0x0024, 0x0000, 0x800a, 0x3e10, 0xb803, 0x4194, 0xb805,
+    0x3e11, 0x0024, 0x3e11, 0xb807, 0x3e14, 0x7812, 0x3e14, 0xf80d,
+    0x3e03, 0xf80e, 0x0006, 0x0051, 0x2800, 0x24d5, 0x0000, 0x0024,
+    0xb888, 0x0012, 0x6404, 0x0405, 0x0000, 0x0024, 0x2800, 0x2158,
+    0x4094, 0x0024, 0x2400, 0x2102, 0x0000, 0x0024, 0x6498, 0x0803,
+    0xfe56, 0x0024, 0x48b6, 0x0024, 0x4dd6, 0x0024, 0x3a10, 0xc024,
+    0x32f0, 0xc024, 0xfe56, 0x0024, 0x48b6, 0x0024, 0x4dd6, 0x0024,
+    0x4384, 0x4483, 0x6396, 0x888c, 0xf400, 0x40d5, 0x3d00, 0x8024,
+    0x0006, 0x0091, 0x003f, 0xfec3, 0x0006, 0x0053, 0x3101, 0x8024,
+    0xfe60, 0x0024, 0x48be, 0x0024, 0xa634, 0x0c03, 0x4324, 0x0024,
+    0x4284, 0x2c02, 0x0006, 0x0011, 0x2800, 0x24d8, 0x3100, 0x8024,
+    0x0006, 0x5011, 0x3900, 0x8024, 0x0006, 0x0011, 0x3100, 0x984c,
+    0x4284, 0x904c, 0xf400, 0x4088, 0x2800, 0x2845, 0x0000, 0x0024,
+    0x3cf0, 0x3840, 0x3009, 0x3841, 0x3009, 0x3810, 0x2000, 0x0000,
+    0x0000, 0x2788, 0x3009, 0x1bd0, 0x2800, 0x2880, 0x3009, 0x1b81,
+    0x34f3, 0x1bcc, 0x36f3, 0xd80e, 0x36f4, 0xd80d, 0x36f4, 0x5812,
+    0x36f1, 0x9807, 0x36f1, 0x1805, 0x36f0, 0x9803, 0x3405, 0x9014,
+    0x36f3, 0x0024, 0x36f2, 0x1815, 0x2000, 0x0000, 0x36f2, 0x9817,
+    0x0007, 0x0001,
+    0x80ad,
+    0x0006, 0x00b7,
+    0x3e12, 0xb817, 0x3e12, 0x3815, 0x3e05, 0xb814, 0x3615, 0x0024,
+    0x0000, 0x800a, 0x3e10, 0x7802, 0x3e10, 0xf804, 0x3e11, 0x7810,
+    0x3e14, 0x7812, 0x2913, 0xc980, 0x3e14, 0xc024, 0x2913, 0xc980,
+    0x4088, 0x184c, 0xf400, 0x4005, 0x0000, 0x18c0, 0x6400, 0x0024,
+    0x0000, 0x1bc0, 0x2800, 0x3095, 0x0030, 0x0310, 0x2800, 0x3f80,
+    0x3801, 0x4024, 0x6400, 0x0024, 0x0000, 0x1a40, 0x2800, 0x3755,
+    0x0006, 0x55d0, 0x0000, 0x7d03, 0xb884, 0x184c, 0x3009, 0x3805,
+    0x3009, 0x0000, 0xff8a, 0x0024, 0x291d, 0x7b00, 0x48b2, 0x0024,
+    0x0000, 0x1841, 0x0006, 0x5010, 0x408a, 0xb844, 0x2900, 0x1300,
+    0x4088, 0x0024, 0x3000, 0x1bcc, 0x6014, 0x0024, 0x0030, 0x0351,
+    0x2800, 0x36d5, 0x0000, 0x0024, 0x0006, 0x0011, 0x3100, 0x0024,
+    0x0030, 0x0351, 0x3800, 0x0024, 0x2800, 0x3f80, 0x3901, 0x4024,
+    0x6400, 0x0024, 0x0030, 0x03d0, 0x2800, 0x3f55, 0x0000, 0x7d03,
+    0x0006, 0x55d0, 0xb884, 0x184c, 0x3009, 0x3805, 0x3009, 0x0000,
+    0xff8a, 0x0024, 0x291d, 0x7b00, 0x48b2, 0x0024, 0x408a, 0x9bcc,
+    0x0000, 0x1841, 0x2800, 0x3b55, 0x0006, 0x5010, 0x689a, 0x0024,
+    0x3000, 0x0024, 0x6014, 0x0024, 0x0030, 0x0392, 0x2800, 0x3e85,
+    0x0006, 0x0091, 0x0006, 0x0011, 0x0000, 0x1852, 0x0006, 0x0053,
+    0xb880, 0x2400, 0x0006, 0x0091, 0x3804, 0x8024, 0x0030, 0x0392,
+    0x3b00, 0x0024, 0x3901, 0x4024, 0x2800, 0x3f80, 0x3a01, 0x4024,
+    0x3801, 0x4024, 0xb880, 0x1bd3, 0x36f4, 0x5812, 0x36f1, 0x5810,
+    0x36f0, 0xd804, 0x36f0, 0x5802, 0x3405, 0x9014, 0x36f3, 0x0024,
+    0x36f2, 0x1815, 0x2000, 0x0000, 0x36f2, 0x9817, 0x0030
 };
 
 /*!
@@ -204,17 +304,14 @@ prog_int dtab[CODE_SIZE] = { /* Data to write */
 /*!
  * \brief Write a specified number of bytes to the VS10XX data interface.
  *
- * Decoder interrupts must have been disabled before calling this function.
+ * The stream feed must be held off, i.e. the player stopped or
+ * vs_tone_active set, or the bytes end up in the middle of the stream.
  */
 static void VsSdiWrite(CONST u_char * data, u_short len)
 {
     VsSelectVs();
 
-    while (len--)
-    {
-        SPIputByte(*data);
-        data++;
-    }
+    SPIwriteBlock(data, len);
 
     VsDeselectVs();
     return;
@@ -245,16 +342,11 @@ static void VsSdiWrite_P(PGM_P data, u_short len)
 /*!
  * \brief Write to a decoder register.
  *
- * Decoder interrupts must have been disabled before calling this function.
+ * Holds the bus for the transaction, the decoder feed waits meanwhile.
  */
 void VsRegWrite(u_char reg, u_short data)
 {
-    u_char spimode;
-
-    spimode = SPIgetmode();
-    SPImode(SPEED_SLOW);
-
-    VsSelectVs();
+    VsSelectSci();
 
     cbi(VS_XCS_PORT, VS_XCS_BIT);
 
@@ -267,7 +359,16 @@ void VsRegWrite(u_char reg, u_short data)
 
     VsDeselectVs();
 
-    SPImode(spimode);
+    /* a reset restores the defaults, so reload the shadow on demand */
+    if (reg == VS_MODE_REG && (data & VS_SM_RESET))
+    {
+        vs_shadow_valid = 0;
+    }
+    else if (VsShadowed(reg))
+    {
+        vs_shadow[reg] = data;
+        vs_shadow_valid |= (1 << reg);
+    }
 
     return;
 }
@@ -319,19 +420,12 @@ u_short VsStreamValid(void)
 /*
  * \brief Read from a register.
  *
- * Decoder interrupts must have been disabled before calling this function.
- *
  * \return Register contents.
  */
 static u_short VsRegRead(u_char reg)
 {
     u_short data;
-    u_char spimode;
-
-    spimode = SPIgetmode();
-    SPImode(SPEED_SLOW);
-
-    VsSelectVs();
+    VsSelectSci();
 
     cbi(VS_XCS_PORT, VS_XCS_BIT);
 
@@ -344,7 +438,12 @@ static u_short VsRegRead(u_char reg)
     sbi(VS_XCS_PORT, VS_XCS_BIT);
 
     VsDeselectVs();
-    SPImode(spimode);
+
+    if (VsShadowed(reg))
+    {
+        vs_shadow[reg] = data;
+        vs_shadow_valid |= (1 << reg);
+    }
 
     return(data);
 }
@@ -352,17 +451,18 @@ static u_short VsRegRead(u_char reg)
 /*!
  * \brief read data from a specified register from the VS10XX
  *
+ * Registers which only change when written by us are returned from
+ * the shadow copy without accessing the decoder. Volatile registers
+ * like HDAT0/HDAT1 and DECODE_TIME are always read from the decoder.
  */
 u_short VsRegInfo(u_char reg)
 {
-    u_char ief;
-    u_short value;
-
-    ief = VsPlayerInterrupts(0);
-    value = VsRegRead(reg);
-    VsPlayerInterrupts(ief);
+    if (VsShadowed(reg) && (vs_shadow_valid & (1 << reg)))
+    {
+        return(vs_shadow[reg]);
+    }
 
-    return(value);
+    return(VsRegRead(reg));
 }
 
 
@@ -396,6 +496,12 @@ u_char VsPlayerInterrupts(u_char enable)
     return(rc);
 }
 
+/*
+ * Number of bytes the decoder accepts without further handshaking
+ * each time DREQ is found active.
+ */
+#define VS_SDI_BLOCK    32
+
 /*
  * \brief Feed the decoder with data.
  *
@@ -403,19 +509,27 @@ u_char VsPlayerInterrupts(u_char enable)
  * - It is called by VsPlayerKick() to initially fill the decoder buffer.
  * - It is used as an interrupt handler for the decoder.
  *
+ * Data is taken from the segmented buffer in contiguous spans and sent
+ * in bursts of VS_SDI_BLOCK bytes. Active DREQ guarantees room for at
+ * least that many bytes in the decoder FIFO, so DREQ is only checked
+ * at block boundaries.
+ *
+ * While a thread holds the SPI bus, the routine leaves without feeding.
+ * SPIend() calls VsPlayerRefill() to catch up on the DREQ edge missed.
+ *
  * Note that although this routine is an ISR, it is called from 'VsPlayerKick' as well
  */
 static void VsPlayerFeed(void *arg)
 {
-    u_short j = 32;
     u_char ief;
+    u_char n;
 
     char *bp;
     size_t consumed;
     size_t available;
 
-    // leave if not running.
-    if ((vs_status != VS_STATUS_RUNNING) || (bit_is_clear(VS_DREQ_PIN, VS_DREQ_BIT)))
+    // leave if not running or while tones are played.
+    if ((vs_status != VS_STATUS_RUNNING) || vs_tone_active || (bit_is_clear(VS_DREQ_PIN, VS_DREQ_BIT)) || SPIbusy())
     {
         return;
     }
@@ -433,9 +547,11 @@ static void VsPlayerFeed(void *arg)
     available = 0;
 
     /*
-     * Feed the decoder with j bytes or we ran out of data.
+     * Feed the decoder block by block as long as DREQ is set or
+     * until we ran out of data. The bus is free, checked above, and
+     * no thread can take it before we are done.
      */
-    VsSelectVs();
+    SPIselect(SPI_DEV_VS10XX);
 
     do
     {
@@ -456,31 +572,44 @@ static void VsPlayerFeed(void *arg)
                 break;
             }
         }
-        if (available != 0) // We have some data in the buffer, feed it.
-        {
-            SPIputByte(*bp);
-            bp++;
-            consumed++;
-        }
+
         /*
-         * appearantly DREQ goes low when less then 32 byte are available
-         * in the internal buffer (2048 bytes)
+         * A span ending at the buffer wrap may leave a short block,
+         * the remainder of it is sent after the next DREQ check.
          */
-
-        /* Allow 32 bytes to be sent as long as DREQ is set. This includes the one in progress */
-        if (bit_is_set(VS_DREQ_PIN, VS_DREQ_BIT))
+        n = VS_SDI_BLOCK;
+        if (available - consumed < VS_SDI_BLOCK)
         {
-            j = 32;
+            n = (u_char)(available - consumed);
         }
-    } while (--j);          // bug solved: j-- counts one too many....
+        SPIwriteBlock((u_char *)bp + consumed, n);
+        consumed += n;
 
-    VsDeselectVs();
+    } while (bit_is_set(VS_DREQ_PIN, VS_DREQ_BIT));
+
+    SPIdeselect();
 
     /* Finally re-enable the producer buffer. */
     NutSegBufReadLast(consumed);
     VsPlayerInterrupts(ief);
 }
 
+/*!
+ * \brief Feed the decoder from thread context.
+ *
+ * DREQ interrupts are edge triggered. An edge that came while the feed
+ * couldn't run, e.g. while the bus was held, is not repeated. This
+ * sends whatever the decoder is waiting for, if it is running.
+ */
+void VsPlayerRefill(void)
+{
+    u_char ief;
+
+    ief = VsPlayerInterrupts(0);
+    VsPlayerFeed(NULL);
+    VsPlayerInterrupts(ief);
+}
+
 
 /*!
  * \brief Start playback.
@@ -577,6 +706,9 @@ int VsPlayerInit(void)
     SPImode(SPEED_SLOW);
 
     vs_status = VS_STATUS_STOPPED;
+    vs_patched = 0;
+    vs_shadow_valid = 0;
+    memset(&vs_info, 0, sizeof(vs_info));
 
     /* Release decoder reset line. */
     sbi(VS_RESET_PORT, VS_RESET_BIT);
@@ -631,6 +763,12 @@ int VsPlayerInit(void)
             }
     }
 
+    /* Restore tone control, lost by the reset */
+    if (vs_bass)
+    {
+        VsRegWrite(VS_BASS_REG, vs_bass);
+    }
+
     /* Register the interrupt routine */
     NutRegisterIrqHandler(&sig_INTERRUPT6, VsPlayerFeed, NULL);
 
@@ -640,6 +778,8 @@ int VsPlayerInit(void)
     /* Clear any spurious interrupt. */
     outp(BV(VS_DREQ_BIT), EIFR);
 
+    vs_ready = 1;
+
     return(0);
 }
 
@@ -668,6 +808,12 @@ int VsPlayerReset(u_short mode)
     VsPlayerSetMode(VS_SM_RESET | mode);
     NutDelay(10);
 
+    /* Restore tone control, lost by the reset */
+    if (vs_ready && vs_bass)
+    {
+        VsRegWrite(VS_BASS_REG, vs_bass);
+    }
+
     /* Clear any spurious interrupts. */
     outp(BV(VS_DREQ_BIT), EIFR);
 
@@ -688,9 +834,6 @@ int VsPlayerReset(u_short mode)
  */
 int VsPlayerSetMode(u_short mode)
 {
-    u_char ief;
-
-    ief = VsPlayerInterrupts(0);
     /*
      *  We need to be sure that the way of interfacing
      *  is not corrupted by setting some new mode
@@ -699,7 +842,12 @@ int VsPlayerSetMode(u_short mode)
      */
     mode |= (VS_SM_SDISHARE | VS_SM_SDINEW);
     VsRegWrite(VS_MODE_REG, mode);
-    VsPlayerInterrupts(ief);
+
+    /* a reset clears the decoder RAM, so the patch code is gone */
+    if (mode & VS_SM_RESET)
+    {
+        vs_patched = 0;
+    }
 
     return(0);
 }
@@ -753,21 +901,16 @@ u_char VsGetStatus(void)
 u_short VsMemoryTest(void)
 {
     u_short rc = -1;
-    u_char ief;
     static prog_char mtcmd[] = { 0x4D, 0xEA, 0x6D, 0x54, 0x00, 0x00, 0x00, 0x00};
 
     VsPlayerReset(0);
     VsPlayerSetMode(VS_SM_TESTS);
 
-    ief = VsPlayerInterrupts(0);
-
     VsSdiWrite_P(mtcmd, sizeof(mtcmd));
     NutDelay(40);
 
     rc = VsRegRead(VS_HDAT0_REG);
 
-    VsPlayerInterrupts(ief);
-
     if ((VsGetType()==VS_VS1003) && (rc == 0x807F))
     {
         rc=0;
@@ -777,189 +920,969 @@ u_short VsMemoryTest(void)
 }
 
 /*!
- * \brief Set volume.
- *
- * \param left  Left channel volume.
- * \param right Right channel volume.
- *
- * \return 0 on success, -1 otherwise.
+ * \brief Write both channel levels to the decoder.
  */
-int VsSetVolume(u_char left, u_char right)
+static void VsVolumeWrite(u_char left, u_char right)
 {
-    u_char ief;
-
-    ief = VsPlayerInterrupts(0);
-
     VsRegWrite(VS_VOL_REG, (((u_short) left) << 8) | (u_short) right);
 
-    VsPlayerInterrupts(ief);
-
-    return(0);
+    vs_vol_cur[0] = left;
+    vs_vol_cur[1] = right;
 }
 
-
 /*!
- * \brief Get volume.
- *
- * \return u_short Volume.
+ * \brief Cancel a running volume ramp.
  */
-u_short VsGetVolume()
+static void VsRampStop(void)
 {
-    u_char ief;
-    u_short vol;
-    ief = VsPlayerInterrupts(0);
-    vol=VsRegRead(VS_VOL_REG);
-    VsPlayerInterrupts(ief);
-    return(vol);
+    if (vs_ramp_timer)
+    {
+        NutTimerStop(vs_ramp_timer);
+        vs_ramp_timer = 0;
+    }
+    vs_ramp_ticks = 0;
 }
 
 /*!
- * \brief Return the number of the VS10xx chip.
+ * \brief Move the volume one step along the ramp.
  *
- * \return  The actual type number as defined
+ * Each channel covers an equal share of the remaining distance, so
+ * the ramp is linear in dB and ends on the target exactly.
  */
-u_short VsGetType(void)
+static void VsRampStep(void)
 {
-    return(g_vs_type);
+    u_char i;
+    u_char level[2];
+    int diff;
+
+    if (vs_ramp_ticks == 0)
+    {
+        return;
+    }
+    for (i = 0; i < 2; i++)
+    {
+        diff = (int)vs_vol_target[i] - (int)vs_vol_cur[i];
+        level[i] = vs_vol_cur[i] + diff / (int)vs_ramp_ticks;
+    }
+    if (--vs_ramp_ticks == 0)
+    {
+        VsRampStop();
+        level[0] = vs_vol_target[0];
+        level[1] = vs_vol_target[1];
+    }
+    if (level[0] != vs_vol_cur[0] || level[1] != vs_vol_cur[1])
+    {
+        VsVolumeWrite(level[0], level[1]);
+    }
 }
 
+/*!
+ * \brief Timer callback, hands the ramp step over to the service thread.
+ */
+static void VsRampTimer(HANDLE timer, void *arg)
+{
+    NutEventPostAsync(&vs_service_evt);
+}
 
 /*!
- * \brief Return the number of the VS10xx chip.
+ * \brief Decoder service thread.
  *
- * \return  The actual type number coded in HEX!
+ * Performs the SCI writes requested by timer callbacks, which must not
+ * access the SPI bus themselves.
  */
-u_short VsGetTypeHex(void)
+THREAD(VsService, arg)
 {
-    switch (g_vs_type)
+    for (;;)
     {
-        case VS_VS1003:  return(0x03);
-        default:         break;         /* Other codes use the actual number. */
+        NutEventWait(&vs_service_evt, NUT_WAIT_INFINITE);
+        VsRampStep();
+        if (vs_tone_due)
+        {
+            vs_tone_due = 0;
+            VsToneStep();
+        }
     }
+}
 
-    return(g_vs_type);
+/*!
+ * \brief Start the decoder service thread, unless running already.
+ *
+ * \return 0 on success, -1 otherwise.
+ */
+static int VsServiceStart(void)
+{
+    if (vs_service_started == 0)
+    {
+        if (NutThreadCreate("vsserv", VsService, 0, VS_SERVICE_STACK) == 0)
+        {
+            LogMsg_P(LOG_ERR, PSTR("can't start service thread"));
+            return(-1);
+        }
+        vs_service_started = 1;
+    }
+    return(0);
 }
 
 /*!
- * \brief Sine wave beep.
+ * \brief Set volume.
  *
- * \param fsin Frequency.
- * \param ms   Duration.
+ * The new level is written immediately and becomes the reference for
+ * VsFadeIn() and VsDuck(). Any running ramp is cancelled.
+ *
+ * \param left  Left channel volume.
+ * \param right Right channel volume.
  *
  * \return 0 on success, -1 otherwise.
  */
-int VsBeep(u_char fsin, u_short ms)
+int VsSetVolume(u_char left, u_char right)
 {
-    u_char ief;
-    static prog_char on[] = { 0x53, 0xEF, 0x6E};
-    static prog_char off[] = { 0x45, 0x78, 0x69, 0x74};
-    static prog_char end[] = { 0x00, 0x00, 0x00, 0x00};
+    VsRampStop();
 
-    /* Disable decoder interrupts. */
-    ief = VsPlayerInterrupts(0);
-
-    VsPlayerSetMode(VS_SM_TESTS);
-
-    fsin = (fsin* 16) + 56;
-    VsSdiWrite_P(on, sizeof(on));
-    VsSdiWrite(&fsin, 1);
-    VsSdiWrite_P(end, sizeof(end));
-    NutDelay(ms);
-    VsSdiWrite_P(off, sizeof(off));
-    VsSdiWrite_P(end, sizeof(end));
+    vs_vol_user[0] = left;
+    vs_vol_user[1] = right;
+    vs_duck = 0;
 
-    /* Enable decoder interrupts. */
-    VsPlayerInterrupts(ief);
+    VsVolumeWrite(left, right);
 
     return(0);
 }
 
 /*!
- * \brief Sine wave beep start.
+ * \brief Ramp the volume to a new level in the background.
  *
- * \param fsin Frequency.
+ * Returns immediately. A request issued while a ramp is running takes
+ * over from the current level, so back-to-back requests coalesce into
+ * a single smooth ramp.
  *
- * \note this routine uses a fixed sample rate (12.000Hz) and
- *       therefor the possible frequencies are limited.
- *       Use 'VsBeepStartRaw' to generate a sinus with
- *       an arbitrary freqeuncy
+ * \param left  Left channel target level, 0 is loudest.
+ * \param right Right channel target level.
+ * \param ms    Duration of the ramp. Below VS_RAMP_TICK the level is
+ *              set at once.
  *
  * \return 0 on success, -1 otherwise.
  */
-int VsBeepStart(u_char fsin)
+int VsVolumeRamp(u_char left, u_char right, u_short ms)
 {
-    return(VsBeepStartRaw(56 + (fsin & 7) * 9));
+    vs_vol_target[0] = left;
+    vs_vol_target[1] = right;
+    vs_ramp_ticks = ms / VS_RAMP_TICK;
+
+    if (vs_ramp_ticks == 0 || VsServiceStart())
+    {
+        VsRampStop();
+        VsVolumeWrite(left, right);
+        return(0);
+    }
+    if (vs_ramp_timer == 0)
+    {
+        vs_ramp_timer = NutTimerStart(VS_RAMP_TICK, VsRampTimer, 0, 0);
+        if (vs_ramp_timer == 0)
+        {
+            vs_ramp_ticks = 0;
+            VsVolumeWrite(left, right);
+            return(-1);
+        }
+    }
+    return(0);
 }
 
 /*!
- * \brief Sine wave beep start in Raw mode.
+ * \brief Add attenuation to a channel level, saturating at mute.
+ */
+static u_char VsVolumeDucked(u_char level)
+{
+    u_short att = (u_short)level + vs_duck;
+
+    return(att > VS_VOL_MUTE ? VS_VOL_MUTE : (u_char)att);
+}
+
+/*!
+ * \brief Fade in to the volume set by VsSetVolume(), less any ducking.
  *
- * \param Raw: b7..b5 determines samplerate
- *        while b4..b0 determines finepitch
+ * \param ms Duration of the fade.
  *
- * \note use the VS1003/VS1011 datasheet to figure out
- *       which value to use for Fs (b7..b5) and
- *       which value to use for S (b4..b0)
+ * \return 0 on success, -1 otherwise.
+ */
+int VsFadeIn(u_short ms)
+{
+    return(VsVolumeRamp(VsVolumeDucked(vs_vol_user[0]), VsVolumeDucked(vs_vol_user[1]), ms));
+}
+
+/*!
+ * \brief Fade out to silence.
  *
+ * The volume set by VsSetVolume() is kept for a later VsFadeIn().
+ *
+ * \param ms Duration of the fade.
  *
  * \return 0 on success, -1 otherwise.
  */
-int VsBeepStartRaw(u_char Raw)
+int VsFadeOut(u_short ms)
 {
-    u_char ief;
-    static prog_char on[] = { 0x53, 0xEF, 0x6E};
-    static prog_char end[] = { 0x00, 0x00, 0x00, 0x00};
-
-    /* Disable decoder interrupts. */
-    ief = VsPlayerInterrupts(0);
-
-    VsPlayerSetMode(VS_SM_TESTS);
-
-    VsSdiWrite_P(on, sizeof(on));
-    VsSdiWrite(&Raw, 1);
-    VsSdiWrite_P(end, sizeof(end));
-
-    /* Enable decoder interrupts. */
-    VsPlayerInterrupts(ief);
-
-    return(0);
+    return(VsVolumeRamp(VS_VOL_MUTE, VS_VOL_MUTE, ms));
 }
 
 /*!
- * \brief Sine wave beep stop.
+ * \brief Lower the volume temporarily, e.g. for an alarm or a message.
+ *
+ * \param att Attenuation in 0.5 dB steps relative to the volume set by
+ *            VsSetVolume(). Zero restores the normal volume.
+ * \param ms  Duration of the fade.
  *
  * \return 0 on success, -1 otherwise.
  */
-int VsBeepStop()
+int VsDuck(u_char att, u_short ms)
 {
-    u_char ief;
-    static prog_char off[] = { 0x45, 0x78, 0x69, 0x74};
-    static prog_char end[] = { 0x00, 0x00, 0x00, 0x00};
+    vs_duck = att;
 
-    /* Disable decoder interrupts. */
-    ief = VsPlayerInterrupts(0);
+    return(VsFadeIn(ms));
+}
 
-    VsSdiWrite_P(off, sizeof(off));
-    VsSdiWrite_P(end, sizeof(end));
 
-    /* Enable decoder interrupts. */
-    VsPlayerInterrupts(ief);
+/*!
+ * \brief Get volume.
+ *
+ * \return u_short Volume.
+ */
+u_short VsGetVolume()
+{
+    return(VsRegInfo(VS_VOL_REG));
+}
+
+/*!
+ * \brief Set bass and treble.
+ *
+ * All four settings share SCI_BASS and are changed with a single
+ * register write, so the decoder never runs with half of a change.
+ * Nothing is written if the settings did not change. Before
+ * VsPlayerInit() the settings are only stored, and applied by it.
+ *
+ * \param tc New settings, values out of range are clipped.
+ *
+ * \return 0 on success, -1 otherwise.
+ */
+int VsSetTone(CONST VSTONECTRL *tc)
+{
+    signed char treble = tc->tc_treble;
+    u_char tfreq = tc->tc_treble_khz;
+    u_char bass = tc->tc_bass;
+    u_char bfreq = tc->tc_bass_hz10;
+    u_short value;
+
+    treble = treble < -8 ? -8 : (treble > 7 ? 7 : treble);
+    tfreq = tfreq < 1 ? 1 : (tfreq > 15 ? 15 : tfreq);
+    bass = bass > 15 ? 15 : bass;
+    bfreq = bfreq < 2 ? 2 : (bfreq > 15 ? 15 : bfreq);
+
+    value = ((u_short)(treble & 0x0F) << 12) | ((u_short)tfreq << 8) | ((u_short)bass << 4) | bfreq;
+
+    /* both amplitudes zero switch the tone control off */
+    if (treble == 0 && bass == 0)
+    {
+        value = 0;
+    }
+    if (value == vs_bass)
+    {
+        return(0);
+    }
+    vs_bass = value;
+
+    if (vs_ready)
+    {
+        VsRegWrite(VS_BASS_REG, value);
+    }
 
     return(0);
 }
 
-static void VsLoadProgramCode(void)
+/*!
+ * \brief Get the current bass and treble settings.
+ *
+ * \param tc Receives the settings.
+ */
+void VsGetTone(VSTONECTRL *tc)
 {
-    int i;
+    tc->tc_treble = (signed char)(vs_bass >> 8) >> 4;
+    tc->tc_treble_khz = (vs_bass >> 8) & 0x0F;
+    tc->tc_bass = (vs_bass >> 4) & 0x0F;
+    tc->tc_bass_hz10 = vs_bass & 0x0F;
+}
 
-    for (i=0;i<CODE_SIZE;i++)
+/*!
+ * \brief Sample the decoder status registers.
+ *
+ * Reads HDAT0, HDAT1, AUDATA and DECODE_TIME in a single SCI
+ * transaction, so the feed can't get in between and the registers
+ * belong to the same frame. Done at most every VS_INFO_PERIOD ms.
+ * Meant to be called by the player thread, other threads use
+ * VsDecoderInfo().
+ *
+ * \return 0 if the registers have been read, -1 if the last sample
+ *         is still recent.
+ */
+int VsDecoderSample(void)
+{
+    static prog_char regs[] = { VS_HDAT0_REG, VS_HDAT1_REG, VS_AUDATA_REG, VS_DECODE_TIME_REG };
+    u_short value[sizeof(regs)];
+    u_short hdat0;
+    u_short hdat1;
+    u_short audata;
+    u_short dtime;
+    u_char i;
+    u_long now = NutGetMillis();
+    u_char hdr[4];
+    MP3FRAMEINFO fi;
+
+    if (vs_info.di_stamp && now - vs_info.di_stamp < VS_INFO_PERIOD)
     {
-        VsRegWrite(PRG_RDB(&atab[i]), PRG_RDW(&dtab[i]));
+        return(-1);
+    }
+
+    VsSelectSci();
+    for (i = 0; i < sizeof(regs); i++)
+    {
+        cbi(VS_XCS_PORT, VS_XCS_BIT);
+        SPIputByte(VS_OPCODE_READ);
+        SPIputByte(PRG_RDB(&regs[i]));
+        value[i] = SPIgetByte() << 8;
+        value[i] |= SPIgetByte();
+        sbi(VS_XCS_PORT, VS_XCS_BIT);
+    }
+    VsDeselectVs();
+
+    hdat0 = value[0];
+    hdat1 = value[1];
+    audata = value[2];
+    dtime = value[3];
+
+    vs_info.di_stamp = now ? now : 1;
+    vs_info.di_time = dtime;
+    vs_info.di_samplerate = audata & 0xFFFE;
+    vs_info.di_channels = (audata & 1) + 1;
+    vs_info.di_bitrate = 0;
+    vs_info.di_format = (hdat1 >= 0xFFE0) ? 0xFFE0 : hdat1;
+
+    if (vs_info.di_format == 0xFFE0)
+    {
+        /* HDAT1/HDAT0 hold the header of the current MPEG frame */
+        hdr[0] = (u_char)(hdat1 >> 8);
+        hdr[1] = (u_char)hdat1;
+        hdr[2] = (u_char)(hdat0 >> 8);
+        hdr[3] = (u_char)hdat0;
+        if (Mp3FrameHeader(hdr, &fi) == 0)
+        {
+            vs_info.di_bitrate = fi.fi_bitrate;
+        }
+    }
+    else if (vs_info.di_format == 0x574D || vs_info.di_format == 0x576d)
+    {
+        /* WMA reports the data rate in bytes per second */
+        vs_info.di_bitrate = (u_short)(((u_long)hdat0 * 8 + 500) / 1000);
+    }
+    return(0);
+}
+
+/*!
+ * \brief Get the last sample of the decoder status.
+ *
+ * Does not access the decoder and may be called by any thread.
+ *
+ * \param di Receives a copy of the sample.
+ *
+ * \return 0 if the decoder was decoding a known format when sampled,
+ *         -1 otherwise.
+ */
+int VsDecoderInfo(VSDECODERINFO *di)
+{
+    *di = vs_info;
+
+    return((vs_info.di_stamp && vs_info.di_format) ? 0 : -1);
+}
+
+/*!
+ * \brief Read a block of decoder memory.
+ *
+ * Sets SCI_WRAMADDR once and reads n words from SCI_WRAM, switching the
+ * SPI clock only once for the whole block.
+ */
+static void VsWramRead(u_short addr, u_short *buf, u_char n)
+{
+    VsSelectSci();
+
+    cbi(VS_XCS_PORT, VS_XCS_BIT);
+    SPIputByte(VS_OPCODE_WRITE);
+    SPIputByte(VS_WRAMADDR_REG);
+    SPIputByte((u_char) (addr >> 8));
+    SPIputByte((u_char) addr);
+    sbi(VS_XCS_PORT, VS_XCS_BIT);
+
+    while (n--)
+    {
+        cbi(VS_XCS_PORT, VS_XCS_BIT);
+        SPIputByte(VS_OPCODE_READ);
+        SPIputByte(VS_WRAM_REG);
+        *buf = SPIgetByte() << 8;
+        *buf |= SPIgetByte();
+        sbi(VS_XCS_PORT, VS_XCS_BIT);
+        buf++;
+    }
+
+    VsDeselectVs();
+}
+
+/*!
+ * \brief Load the spectrum analyzer plugin and start reading bands.
+ *
+ * The plugin image is supplied by the application in VLSI's compressed
+ * format and must stay in program space. It is reloaded automatically
+ * along with the patch code after a decoder reset.
+ *
+ * Must be called while the player is stopped. The bus is held for the
+ * whole load, so the feed can't run and the decoder would be starved.
+ *
+ * No image is shipped and nothing in this application calls the
+ * analyzer yet. A user interface polls VsSpectrumRead() from its
+ * display loop and draws the levels with LcdBarGraph().
+ *
+ * \param plugin Pointer to the plugin image in program space.
+ * \param words  Size of the image in words.
+ *
+ * \return Number of bands, -1 on failure.
+ */
+int VsSpectrumStart(CONST u_short *plugin, u_short words)
+{
+    u_short bands;
+
+    if (vs_status == VS_STATUS_RUNNING || VsPluginLoad(plugin, words))
+    {
+        return(-1);
+    }
+    VsWramRead(VS_SA_BANDS_ADDR, &bands, 1);
+
+    if (bands == 0)
+    {
+        return(-1);
+    }
+    if (bands > VS_SA_MAX_BANDS)
+    {
+        bands = VS_SA_MAX_BANDS;
+    }
+    vs_sa_plugin = plugin;
+    vs_sa_words = words;
+    vs_sa_bands = (u_char)bands;
+    vs_sa_stamp = 0;
+    memset(vs_sa_level, 0, sizeof(vs_sa_level));
+
+    /* one WRAMADDR write plus one read per band */
+    vs_sa_period = (u_short)(((u_long)(bands + 1) * VS_SCI_READ_US * 1000) / VS_SA_BUDGET_US);
+    if (vs_sa_period < VS_SA_MIN_PERIOD)
+    {
+        vs_sa_period = VS_SA_MIN_PERIOD;
+    }
+    LogMsg_P(LOG_INFO, PSTR("spectrum %u bands every %u ms"), vs_sa_bands, vs_sa_period);
+
+    return(vs_sa_bands);
+}
+
+/*!
+ * \brief Stop reading bands.
+ *
+ * The plugin stays resident until the next decoder reset.
+ */
+void VsSpectrumStop(void)
+{
+    vs_sa_plugin = 0;
+    vs_sa_bands = 0;
+}
+
+/*!
+ * \brief Get the current band levels.
+ *
+ * The decoder is read with a single batched SCI sequence, but not more
+ * often than the SPI time budget allows. In between the last values
+ * are returned. Thus the caller sets the display rate, the budget only
+ * limits the rate of the SCI reads.
+ *
+ * \param level Receives the band levels, 0..63.
+ * \param max   Size of the level array.
+ *
+ * \return Number of bands stored, -1 if the analyzer is not running.
+ */
+int VsSpectrumRead(u_char *level, u_char max)
+{
+    u_char i;
+    u_short raw[VS_SA_MAX_BANDS];
+    u_long now = NutGetMillis();
+
+    if (vs_sa_bands == 0)
+    {
+        return(-1);
+    }
+    if (vs_sa_stamp == 0 || now - vs_sa_stamp >= vs_sa_period)
+    {
+        vs_sa_stamp = now ? now : 1;
+
+        VsWramRead(VS_SA_DATA_ADDR, raw, vs_sa_bands);
+
+        for (i = 0; i < vs_sa_bands; i++)
+        {
+            vs_sa_level[i] = (u_char)(raw[i] & VS_SA_LEVEL_MASK);
+        }
+    }
+    if (max > vs_sa_bands)
+    {
+        max = vs_sa_bands;
+    }
+    memcpy(level, vs_sa_level, max);
+
+    return(max);
+}
+
+/*!
+ * \brief Return the number of the VS10xx chip.
+ *
+ * \return  The actual type number as defined
+ */
+u_short VsGetType(void)
+{
+    return(g_vs_type);
+}
+
+
+/*!
+ * \brief Return the number of the VS10xx chip.
+ *
+ * \return  The actual type number coded in HEX!
+ */
+u_short VsGetTypeHex(void)
+{
+    switch (g_vs_type)
+    {
+        case VS_VS1003:  return(0x03);
+        default:         break;         /* Other codes use the actual number. */
+    }
+
+    return(g_vs_type);
+}
+
+/*!
+ * \brief Send the sine test start sequence.
+ *
+ * Test mode must have been enabled and vs_tone_active set before
+ * calling this function.
+ */
+static void VsSineStart(u_char raw)
+{
+    static prog_char on[] = { 0x53, 0xEF, 0x6E};
+    static prog_char end[] = { 0x00, 0x00, 0x00, 0x00};
+
+    VsSdiWrite_P(on, sizeof(on));
+    VsSdiWrite(&raw, 1);
+    VsSdiWrite_P(end, sizeof(end));
+}
+
+/*!
+ * \brief Send the sine test stop sequence.
+ */
+static void VsSineStop(void)
+{
+    static prog_char off[] = { 0x45, 0x78, 0x69, 0x74};
+    static prog_char end[] = { 0x00, 0x00, 0x00, 0x00};
+
+    VsSdiWrite_P(off, sizeof(off));
+    VsSdiWrite_P(end, sizeof(end));
+}
+
+/*!
+ * \brief Timer callback, hands the next tone over to the service thread.
+ */
+static void VsToneTimer(HANDLE timer, void *arg)
+{
+    vs_tone_due = 1;
+    NutEventPostAsync(&vs_service_evt);
+}
+
+/*!
+ * \brief Play the next queued tone or finish the sequence.
+ *
+ * The first tone of a sequence stops feeding stream data and enables
+ * test mode. After the last one the previous mode is restored and the
+ * feed picks up where it left off.
+ */
+static void VsToneStep(void)
+{
+    VSTONE tn;
+
+    if (vs_tone_sine)
+    {
+        VsSineStop();
+        vs_tone_sine = 0;
+    }
+
+    if (vs_tone_count == 0)
+    {
+        VsPlayerSetMode(vs_tone_mode);
+        vs_tone_active = 0;
+
+        /* DREQ interrupts are edge triggered, get the feed going again */
+        VsPlayerRefill();
+        return;
+    }
+
+    tn = vs_tone_q[vs_tone_head];
+    vs_tone_head = (vs_tone_head + 1) % VS_TONE_QUEUE;
+    vs_tone_count--;
+
+    if (vs_tone_active == 0)
+    {
+        vs_tone_active = 1;
+        vs_tone_mode = VsRegInfo(VS_MODE_REG) & ~(VS_SM_TESTS | VS_SM_RESET);
+        VsPlayerSetMode(vs_tone_mode | VS_SM_TESTS);
+    }
+    if (tn.tn_raw)
+    {
+        VsSineStart(tn.tn_raw);
+        vs_tone_sine = 1;
+    }
+
+    if (NutTimerStart(tn.tn_ms ? tn.tn_ms : 1, VsToneTimer, 0, TM_ONESHOT) == 0)
+    {
+        vs_tone_due = 1;
+        NutEventPost(&vs_service_evt);
+    }
+}
+
+/*!
+ * \brief Queue a tone in raw sine test format.
+ *
+ * Returns immediately, the tone is played after the ones queued before.
+ *
+ * \param raw Sine test value as used by VsBeepStartRaw(), 0 for a rest.
+ * \param ms  Duration.
+ *
+ * \return 0 on success, -1 if the queue is full.
+ */
+int VsToneQueueRaw(u_char raw, u_short ms)
+{
+    if (vs_tone_count >= VS_TONE_QUEUE || VsServiceStart())
+    {
+        return(-1);
+    }
+    vs_tone_q[(vs_tone_head + vs_tone_count) % VS_TONE_QUEUE].tn_raw = raw;
+    vs_tone_q[(vs_tone_head + vs_tone_count) % VS_TONE_QUEUE].tn_ms = ms;
+    vs_tone_count++;
+
+    if (vs_tone_active == 0)
+    {
+        VsToneStep();
+    }
+    return(0);
+}
+
+/*!
+ * \brief Queue a tone.
+ *
+ * \param fsin Frequency as used by VsBeepStart(), VS_TONE_REST for a rest.
+ * \param ms   Duration.
+ *
+ * \return 0 on success, -1 if the queue is full.
+ */
+int VsToneQueue(u_char fsin, u_short ms)
+{
+    return(VsToneQueueRaw(fsin == VS_TONE_REST ? 0 : 56 + (fsin & 7) * 9, ms));
+}
+
+/*!
+ * \brief Queue one of the predefined sounds.
+ *
+ * \param sound VS_SOUND_CLICK, VS_SOUND_ERROR or VS_SOUND_ALARM.
+ *
+ * \return 0 on success, -1 if the queue is full.
+ */
+int VsToneSound(u_char sound)
+{
+    /* pairs of frequency and duration, terminated by a zero duration */
+    static prog_char click[] = { 7, 2, 0, 0 };
+    static prog_char error[] = { 2, 15, VS_TONE_REST, 5, 1, 30, 0, 0 };
+    static prog_char alarm[] = { 6, 25, VS_TONE_REST, 10, 6, 25, VS_TONE_REST, 10, 6, 25, VS_TONE_REST, 90, 0, 0 };
+    PGM_P tab;
+    int rc = 0;
+
+    switch (sound)
+    {
+        case VS_SOUND_CLICK: tab = click; break;
+        case VS_SOUND_ERROR: tab = error; break;
+        case VS_SOUND_ALARM: tab = alarm; break;
+        default: return(-1);
+    }
+    for (; PRG_RDB(tab + 1) && rc == 0; tab += 2)
+    {
+        /* durations are stored in units of 10 ms */
+        rc = VsToneQueue(PRG_RDB(tab), (u_short)PRG_RDB(tab + 1) * 10);
+    }
+    return(rc);
+}
+
+/*!
+ * \brief Drop all queued tones.
+ *
+ * The tone playing now is finished, then the stream resumes.
+ */
+void VsToneClear(void)
+{
+    vs_tone_count = 0;
+}
+
+/*!
+ * \brief Sine wave beep.
+ *
+ * Queues the beep and returns immediately.
+ *
+ * \param fsin Frequency.
+ * \param ms   Duration.
+ *
+ * \return 0 on success, -1 otherwise.
+ */
+int VsBeep(u_char fsin, u_short ms)
+{
+    return(VsToneQueueRaw((fsin* 16) + 56, ms));
+}
+
+/*!
+ * \brief Sine wave beep start.
+ *
+ * \param fsin Frequency.
+ *
+ * \note this routine uses a fixed sample rate (12.000Hz) and
+ *       therefor the possible frequencies are limited.
+ *       Use 'VsBeepStartRaw' to generate a sinus with
+ *       an arbitrary freqeuncy
+ *
+ * \return 0 on success, -1 otherwise.
+ */
+int VsBeepStart(u_char fsin)
+{
+    return(VsBeepStartRaw(56 + (fsin & 7) * 9));
+}
+
+/*!
+ * \brief Sine wave beep start in Raw mode.
+ *
+ * \param Raw: b7..b5 determines samplerate
+ *        while b4..b0 determines finepitch
+ *
+ * \note use the VS1003/VS1011 datasheet to figure out
+ *       which value to use for Fs (b7..b5) and
+ *       which value to use for S (b4..b0)
+ *
+ *
+ * \return 0 on success, -1 otherwise.
+ */
+int VsBeepStartRaw(u_char Raw)
+{
+    VsPlayerSetMode(VS_SM_TESTS);
+
+    VsSineStart(Raw);
+
+    return(0);
+}
+
+/*!
+ * \brief Sine wave beep stop.
+ *
+ * \return 0 on success, -1 otherwise.
+ */
+int VsBeepStop()
+{
+    VsSineStop();
+
+    return(0);
+}
+
+/*!
+ * \brief Write a run of words to a decoder register in a single SCI
+ *        transaction.
+ *
+ * The decoder accepts further words as long as XCS is kept low. It
+ * drops DREQ while it processes each word, so DREQ is polled before
+ * every word. The polls of the whole run are limited to
+ * VS_RUN_DREQ_POLLS, DREQ also stays low while the stream FIFO is full.
+ *
+ * \param reg    Register to write to.
+ * \param data   Pointer to the words in program space.
+ * \param n      Number of words to write.
+ * \param repeat If not zero, the first word is written n times.
+ *
+ * \return 0 on success, -1 if DREQ didn't come in time.
+ */
+static int VsRegWriteRun(u_char reg, prog_int *data, u_short n, u_char repeat)
+{
+    u_short value;
+    u_short wait = VS_RUN_DREQ_POLLS;
+    int rc = 0;
+
+    VsSelectSci();
+
+    cbi(VS_XCS_PORT, VS_XCS_BIT);
+
+    SPIputByte(VS_OPCODE_WRITE);
+    SPIputByte(reg);
+
+    while (n--)
+    {
+        value = (u_short)PRG_RDW(data);
+        if (repeat == 0)
+        {
+            data++;
+        }
+        while (bit_is_clear(VS_DREQ_PIN, VS_DREQ_BIT))
+        {
+            if (wait-- == 0)
+            {
+                rc = -1;
+                break;
+            }
+        }
+        if (rc)
+        {
+            break;
+        }
+        SPIputByte((u_char) (value >> 8));
+        SPIputByte((u_char) value);
+    }
+
+    sbi(VS_XCS_PORT, VS_XCS_BIT);
+
+    VsDeselectVs();
+
+    return(rc);
+}
+
+/*!
+ * \brief Load a plugin in VLSI's compressed format into the decoder.
+ *
+ * \param plugin Pointer to the plugin image in program space.
+ * \param words  Size of the image in words.
+ *
+ * \return 0 on success, -1 if the image is malformed or the decoder
+ *         didn't take it.
+ */
+int VsPluginLoad(CONST u_short *plugin, u_short words)
+{
+    prog_int *ip = (prog_int *)plugin;
+    prog_int *end = ip + words;
+    u_char reg;
+    u_short n;
+
+    while (ip + 2 <= end)
+    {
+        reg = (u_char)PRG_RDW(ip);
+        n = (u_short)PRG_RDW(ip + 1);
+        ip += 2;
+
+        if (n & 0x8000)
+        {
+            n &= 0x7FFF;
+            if (ip + 1 > end)
+            {
+                return(-1);
+            }
+            if (VsRegWriteRun(reg, ip, n, 1))
+            {
+                return(-1);
+            }
+            ip++;
+        }
+        else
+        {
+            if (ip + n > end)
+            {
+                return(-1);
+            }
+            if (VsRegWriteRun(reg, ip, n, 0))
+            {
+                return(-1);
+            }
+            ip += n;
+        }
         // kick watchdog on a regular base
-        if(i%500==0)
+        WatchDogRestart();
+    }
+    return(ip == end ? 0 : -1);
+}
+
+/*!
+ * \brief Verify that a plugin is still resident in the decoder.
+ *
+ * Each block of plugin code starts with a write to SCI_WRAMADDR. The first
+ * CODE_SAMPLES words of every block are read back through SCI_WRAM and
+ * compared with the image.
+ *
+ * \return 0 if all sampled words match, -1 otherwise.
+ */
+static int VsPluginCheck(prog_int *ip, u_short words)
+{
+    prog_int *end = ip + words;
+    u_char reg;
+    u_char samples = 0;
+    u_short n;
+    u_short i;
+
+    while (ip + 2 <= end)
+    {
+        reg = (u_char)PRG_RDW(ip);
+        n = (u_short)PRG_RDW(ip + 1);
+        ip += 2;
+
+        for (i = 0; i < (n & 0x7FFF) && ip < end; i++)
         {
-            WatchDogRestart();
+            if (reg == VS_WRAMADDR_REG)
+            {
+                VsRegWrite(VS_WRAMADDR_REG, PRG_RDW(ip));
+                samples = CODE_SAMPLES;
+            }
+            else if (reg == VS_WRAM_REG && samples)
+            {
+                if (VsRegRead(VS_WRAM_REG) != (u_short)PRG_RDW(ip))
+                {
+                    return(-1);
+                }
+                samples--;
+            }
+            if ((n & 0x8000) == 0)
+            {
+                ip++;
+            }
+        }
+        if (n & 0x8000)
+        {
+            ip++;
+        }
+    }
+    return(0);
+}
+
+/*!
+ * \brief Load the patch code into the decoder, unless it is resident.
+ */
+static void VsLoadProgramCode(void)
+{
+    if (vs_patched)
+    {
+        if (VsPluginCheck(vs_patch, sizeof(vs_patch) / sizeof(vs_patch[0])) == 0)
+        {
+            return;
         }
+        LogMsg_P(LOG_WARNING, PSTR("patch code lost, reloading"));
+    }
+
+    if (VsPluginLoad((CONST u_short *)vs_patch, sizeof(vs_patch) / sizeof(vs_patch[0])) == 0)
+    {
+        vs_patched = 1;
+    }
+    if (vs_sa_plugin)
+    {
+        VsPluginLoad(vs_sa_plugin, vs_sa_words);
     }
 }
 /*@}*/